@@ -18,12 +18,66 @@
 @end
 
 #define kAHLayoutAnimation @"AHLayoutAnimation"
+// Pool used by dequeueReusableView, its views are made from viewClass
+#define kAHLayoutDefaultReuseIdentifier @"AHLayoutDefaultReuseIdentifier"
 
 @class AHLayout;
 @class AHLayoutObject;
 typedef void(^AHLayoutHandler)(AHLayout *layout);
 typedef void(^AHLayoutViewAnimationBlock)(AHLayout *layout, TUIView *view);
 
+// Counters for one reuse pool. A miss means a new view had to be made, a discard
+// that a view was thrown away because its pool was full or trimmed.
+typedef struct {
+    NSUInteger hits;
+    NSUInteger misses;
+    NSUInteger discards;
+    NSUInteger pooled;
+} AHLayoutReuseStatistics;
+
+// Where the time of one transaction went. Animated transactions run a prelayout
+// pass, the animation and the wrap up after it, others lay out in a single pass.
+// Counters include work done outside any transaction since the previous one,
+// such as the start of reloadData, but not the passes that only scroll.
+typedef struct {
+    BOOL animated;
+    NSTimeInterval layoutTime;
+    NSTimeInterval prelayoutTime;
+    NSTimeInterval animatingTime;
+    NSTimeInterval doneAnimatingTime;
+    // Sizes, views and section info asked of the data source
+    NSUInteger dataSourceCalls;
+    NSUInteger viewsCreated;
+    NSUInteger viewsDequeued;
+    NSUInteger viewsRecycled;
+    // Views given a new frame
+    NSUInteger viewsLaidOut;
+} AHLayoutTransactionStatistics;
+
+// How far beyond the visible rect views are made, laid out and drawn, along the
+// scrolling axis. Leading is the side the scroll is heading for, trailing the
+// side it comes from, both sides lead until the first scroll. Each side is
+// the sum of points, a fraction of the visible extent and, for the leading
+// side, the distance scrolled at the current speed in velocityLookahead seconds.
+typedef struct {
+    CGFloat leading;
+    CGFloat trailing;
+    CGFloat leadingFraction;
+    CGFloat trailingFraction;
+    NSTimeInterval velocityLookahead;
+} AHLayoutOverscan;
+
+typedef void(^AHLayoutStatisticsHandler)(AHLayout *layout, AHLayoutTransactionStatistics statistics);
+
+// A place in the content that holds through reloads and resizes: a view, and
+// how far its leading edge, the top or the left of horizontal layouts, is
+// inside the leading edge of the visible rect. The index is NSNotFound when
+// nothing is on screen.
+typedef struct {
+    NSUInteger index;
+    CGFloat offset;
+} AHLayoutAnchor;
+
 typedef enum {
 	AHLayoutScrollPositionNone,
 	AHLayoutScrollPositionTop,
@@ -37,23 +91,58 @@ typedef enum {
 typedef enum {
 	AHLayoutVertical,
     AHLayoutHorizontal,
+    // Views are packed left to right into rows as wide as the layout,
+    // the rows scroll vertically
+    AHLayoutFlow,
+    // Views are stacked into numberOfColumns equal width columns, each one
+    // going into the shortest column, the columns scroll vertically
+    AHLayoutMasonry,
 } AHLayoutType;
 
 
 @protocol AHLayoutDataSource;
+@protocol AHLayoutPrefetchDataSource;
 
 @interface AHLayout : TUIScrollView <TUIScrollViewDelegate>
 
 @property (nonatomic, weak) NSObject<AHLayoutDataSource> *dataSource;
+// Told about views that are about to scroll into view, see AHLayoutPrefetchDataSource
+@property (nonatomic, weak) NSObject<AHLayoutPrefetchDataSource> *prefetchDataSource;
 
 @property (nonatomic, weak) Class viewClass;
 @property (nonatomic) AHLayoutType typeOfLayout;
 @property (nonatomic) CGFloat spaceBetweenViews;
+// Columns in an AHLayoutMasonry layout, 2 by default. Set before reloadData.
+@property (nonatomic) NSUInteger numberOfColumns;
 @property (nonatomic, readonly) NSInteger numberOfViews;
 @property (nonatomic, strong) NSDate *reloadedDate;
 @property (nonatomic, copy) AHLayoutHandler reloadHandler;
 @property (nonatomic, readonly) NSArray *visibleViews;
 @property (nonatomic) BOOL didFirstLayout;
+// When set, or when the data source implements layout:estimatedSizeOfViewAtIndex:,
+// views start out at their estimated size and the data source is only asked
+// for the real size once a view comes near the screen.
+@property (nonatomic) CGSize estimatedViewSize;
+// Keep the header of the section at the top of the screen pinned there
+// until the next header pushes it off, YES by default
+@property (nonatomic) BOOL stickyHeaders;
+@property (nonatomic, readonly) NSUInteger numberOfSections;
+// None by default. Views leaving the overscan are recycled.
+@property (nonatomic) AHLayoutOverscan overscan;
+// Off by default, nothing is timed or counted until turned on
+@property (nonatomic) BOOL collectsTransactionStatistics;
+@property (nonatomic, readonly) AHLayoutTransactionStatistics lastTransactionStatistics;
+// Called once for every transaction while collecting statistics, an animated
+// one when its animation ends
+@property (nonatomic, copy) AHLayoutStatisticsHandler transactionStatisticsHandler;
+// A file keeping measured sizes between launches, nil by default. When set and
+// the data source implements layout:identifierOfViewAtIndex:, reloadData lays
+// views out at the size they had last time, and the data source is asked for
+// the real size once a view comes near the screen.
+@property (nonatomic, copy) NSString *sizeCachePath;
+// The first view on screen and where it is. reloadData and live resizing keep it
+// in place. Setting it scrolls the view there, and both cost a frame lookup.
+@property (nonatomic) AHLayoutAnchor anchor;
 
 #pragma mark - General
 
@@ -68,6 +157,26 @@ typedef enum {
 -(TUIView*) replaceViewForObjectAtIndex:(NSUInteger) index withSize:(CGSize) size;
 -(NSUInteger) objectIndexAtTopOfScreen;
 
+#pragma mark - View reuse
+// Each reuse identifier has its own pool of views, made from the registered
+// class or viewClass. Pools hold at most 64 views unless set otherwise, and are
+// halved on a memory pressure warning and emptied when it turns critical.
+- (void)registerClass:(Class)viewClass forReuseIdentifier:(NSString *)identifier;
+- (TUIView *)dequeueReusableViewWithIdentifier:(NSString *)identifier;
+- (void)setMaximumReusableViews:(NSUInteger)count forReuseIdentifier:(NSString *)identifier;
+// Fills the pool up to count views ahead of the first layout
+- (void)prewarmReusableViews:(NSUInteger)count forReuseIdentifier:(NSString *)identifier;
+- (void)trimReusableViews;
+- (void)purgeReusableViews;
+- (AHLayoutReuseStatistics)reuseStatisticsForIdentifier:(NSString *)identifier;
+
+#pragma mark - Sections
+// Views keep their flat index across all sections, these map between the two
+-(NSUInteger) sectionForViewAtIndex:(NSUInteger) index;
+-(NSRange) rangeOfViewsInSection:(NSUInteger) section;
+-(CGRect) rectForHeaderInSection:(NSUInteger) section;
+-(TUIView*) headerViewForSection:(NSUInteger) section;
+
 #pragma mark - Layout transactions
 -(void) beginUpdates;
 -(void) endUpdates;
@@ -81,7 +190,37 @@ typedef enum {
 -(void) insertViewAtIndex:(NSUInteger) index;
 -(void) insertViewAtIndex:(NSUInteger) index  animationBlock:(AHLayoutViewAnimationBlock)animationBlock  completionBlock:(void (^)())completionBlock;
 -(void)removeViewsAtIndexes:(NSIndexSet *)indexes animationBlock:(AHLayoutViewAnimationBlock)animationBlock  completionBlock:(void (^)())completionBlock;
+// Runs of views at either end, for lists that load more as they are scrolled and
+// let go of what is far behind. A run is a single change however long it is, and
+// the first view on screen stays where it is while the content grows or shrinks
+// around it. Call after updating the data source.
 -(void) prependNumOfViews:(NSInteger) numOfObjects animationBlock:(void (^)())animationBlock  completionBlock:(void (^)())completionBlock;
+-(void) appendNumOfViews:(NSInteger) numOfObjects animationBlock:(void (^)())animationBlock  completionBlock:(void (^)())completionBlock;
+-(void) removeViewsInRange:(NSRange) range animationBlock:(AHLayoutViewAnimationBlock)animationBlock  completionBlock:(void (^)())completionBlock;
+
+// Moves keep the view on screen and animate it to its new place. toIndex is
+// where the view ends up once the move is done.
+-(void) moveViewAtIndex:(NSUInteger) fromIndex toIndex:(NSUInteger) toIndex;
+-(void) moveViewAtIndex:(NSUInteger) fromIndex toIndex:(NSUInteger) toIndex animationBlock:(void (^)())animationBlock completionBlock:(void (^)())completionBlock;
+// Maps old indexes to new ones, both NSNumbers
+-(void) moveViews:(NSDictionary*) moves animationBlock:(void (^)())animationBlock completionBlock:(void (^)())completionBlock;
+
+// Applies any number of changes in one animated transaction. Deletions, reloads and
+// the keys of moves are indexes before the update, insertions and the values of
+// moves (both NSNumbers) are indexes after it. Call after updating the data source.
+-(void) performBatchUpdatesWithInsertions:(NSIndexSet*) insertions deletions:(NSIndexSet*) deletions reloads:(NSIndexSet*) reloads moves:(NSDictionary*) moves animationBlock:(AHLayoutViewAnimationBlock)animationBlock completionBlock:(void (^)())completionBlock;
+
+#pragma mark - Snapshots
+// A snapshot names every view, in order, by an identifier for what it shows,
+// such as the ID of its model object. Identifiers are compared with isEqual:
+// and should be unique. Each snapshot is diffed against the one before it and
+// applied as one batched update: views whose identifier is in both keep their
+// view and animate to their new place, the others are inserted and removed,
+// and those in reloadedIdentifiers are reloaded. The first snapshot, or one
+// following reloadData or an index based update, reloads the data. Call after
+// updating the data source.
+-(void) applySnapshotWithIdentifiers:(NSArray*) identifiers reloadedIdentifiers:(NSSet*) reloadedIdentifiers animationBlock:(AHLayoutViewAnimationBlock)animationBlock completionBlock:(void (^)())completionBlock;
+@property (nonatomic, readonly) NSArray *snapshotIdentifiers;
 
 # pragma mark - Scrolling
 
@@ -99,7 +238,47 @@ typedef enum {
 - (CGSize)layout:(AHLayout *)layout sizeOfViewAtIndex:(NSUInteger)index;
 - (TUIView *)layout:(AHLayout *)layout viewForIndex:(NSInteger)index;
 
+@optional
+// A cheap guess at the size of a view, used in place of layout:sizeOfViewAtIndex:
+// until the view is about to be shown. Makes large data sources fast to load.
+- (CGSize)layout:(AHLayout *)layout estimatedSizeOfViewAtIndex:(NSUInteger)index;
+// Sizes of the views in range as NSValue wrapped CGSizes. When implemented,
+// reloadData uses this instead of layout:sizeOfViewAtIndex: and calls it for
+// batches of views concurrently from background threads, so it must be thread safe.
+- (NSArray *)layout:(AHLayout *)layout sizesOfViewsInRange:(NSRange)range;
+// A string naming the content of the view at index, the same from one launch to
+// the next. Used to find the view's size in the sizeCachePath file.
+- (NSString *)layout:(AHLayout *)layout identifierOfViewAtIndex:(NSUInteger)index;
+
+// Sections split the views into consecutive runs, the counts should add up to
+// numberOfViewsInLayout:. Only vertical and horizontal layouts show headers,
+// which span the full width (or height) of the layout.
+// The sections are asked for again on the layout pass that applies an
+// insertion, removal, move or snapshot, so by then the counts must include it.
+- (NSUInteger)numberOfSectionsInLayout:(AHLayout *)layout;
+- (NSUInteger)layout:(AHLayout *)layout numberOfViewsInSection:(NSUInteger)section;
+- (CGSize)layout:(AHLayout *)layout sizeOfHeaderInSection:(NSUInteger)section;
+- (TUIView *)layout:(AHLayout *)layout viewForHeaderInSection:(NSUInteger)section;
+
 @end
 
+//////////////////////////////////////////////////////////////
+#pragma mark Protocol AHLayoutPrefetchDataSource
+//////////////////////////////////////////////////////////////
 
+// Lets a data source load expensive content ahead of layout:viewForIndex:.
+// The window of indexes runs ahead of the scroll, and grows with the speed of
+// a drag or throw, up to a few screens. Both are called on the main thread,
+// start the work on a background queue and return.
+@protocol AHLayoutPrefetchDataSource <NSObject>
 
+@required
+// Indexes newly in the window, none of them on screen yet
+- (void)layout:(AHLayout *)layout prefetchIndexes:(NSIndexSet *)indexes;
+
+@optional
+// Indexes that left the window without coming on screen, or every prefetched
+// index when the views are reloaded or changed
+- (void)layout:(AHLayout *)layout cancelPrefetchingForIndexes:(NSIndexSet *)indexes;
+
+@end
@@ -13,7 +13,12 @@
 #error This project must be compiled with ARC (Xcode 4.2+ with LLVM 3.0 and above)
 #endif
 
+#import <objc/runtime.h>
 #import "AHLayout.h"
+#import "AHLayoutCore.h"
+#import "AHLayoutDiff.h"
+#import "AHLayoutSectionIndex.h"
+#import "AHLayoutSizeCache.h"
 
 @implementation NSString(TUICompare)
 
@@ -27,38 +32,360 @@
 @end
 
 #define kAHLayoutDefaultAnimationDuration 0.5
+#define kAHLayoutMaxMeasuringPasses 4
+#define kAHLayoutSizingBatchSize 256
+// How far ahead a drag prefetches, in seconds of scrolling at its current speed
+#define kAHLayoutPrefetchLookahead 0.5
+#define kAHLayoutMaxPrefetchScreens 6
+// Frame rate of TUIScrollView's throw, which slows by decelerationRate every frame
+#define kAHLayoutThrowFramesPerSecond 60.0
+#define kAHLayoutDefaultMaximumReusableViews 64
+// Sizes kept in the size cache before it starts afresh
+#define kAHLayoutSizeCacheMaximumCount (1 << 20)
+
+static char AHLayoutReuseIdentifierKey;
+
+// Between Core Graphics and the geometry core
+static inline AHLayoutPoint AHPointFromCGPoint(CGPoint point) {
+    AHLayoutPoint p = {point.x, point.y};
+    return p;
+}
+
+static inline CGPoint AHCGPointFromPoint(AHLayoutPoint point) {
+    return CGPointMake(point.x, point.y);
+}
+
+static inline AHLayoutSize AHSizeFromCGSize(CGSize size) {
+    AHLayoutSize s = {size.width, size.height};
+    return s;
+}
+
+static inline CGSize AHCGSizeFromSize(AHLayoutSize size) {
+    return CGSizeMake(size.width, size.height);
+}
+
+static inline AHLayoutItemFrame AHFrameFromRect(CGRect rect) {
+    AHLayoutItemFrame frame = {rect.origin.x, rect.origin.y, rect.size.width, rect.size.height};
+    return frame;
+}
+
+static inline CGRect AHRectFromFrame(AHLayoutItemFrame frame) {
+    return CGRectMake(frame.x, frame.y, frame.width, frame.height);
+}
+
+// How a transaction's resizes moved an object, see oldFrameForIndex:
+typedef struct {
+    NSInteger index;
+    // Change in size of the object, and along the scrolling axis of every one before it
+    CGSize deltaAt;
+    CGFloat deltaBefore;
+} AHLayoutOldFrameDelta;
+
+static int AHCompareOldFrameDeltas(const void *a, const void *b) {
+    NSInteger x = ((const AHLayoutOldFrameDelta *)a)->index, y = ((const AHLayoutOldFrameDelta *)b)->index;
+    return x < y ? -1 : x > y;
+}
+
+// Adds the times and counts of `more` to `statistics`
+static void AHAddTransactionStatistics(AHLayoutTransactionStatistics *statistics, AHLayoutTransactionStatistics more) {
+    statistics->animated = statistics->animated || more.animated;
+    statistics->layoutTime += more.layoutTime;
+    statistics->prelayoutTime += more.prelayoutTime;
+    statistics->animatingTime += more.animatingTime;
+    statistics->doneAnimatingTime += more.doneAnimatingTime;
+    statistics->dataSourceCalls += more.dataSourceCalls;
+    statistics->viewsCreated += more.viewsCreated;
+    statistics->viewsDequeued += more.viewsDequeued;
+    statistics->viewsRecycled += more.viewsRecycled;
+    statistics->viewsLaidOut += more.viewsLaidOut;
+}
 
+// Per-item flag bits kept alongside the sizes in the offset index
+enum {
+    AHLayoutObjectFlagInserted = 1 << 0,
+    // The size came from the data source rather than an estimate
+    AHLayoutObjectFlagMeasured = 1 << 1,
+    // Carries a reload across a move, only ever set on a change list object
+    AHLayoutObjectFlagReloaded = 1 << 2,
+};
+
+// A pending insertion, removal, resize or move of one object.
+// These only live in a transaction's change list, the objects themselves
+// are stored as sizes and flags in the offset index.
 @interface AHLayoutObject : NSObject
 
 @property (nonatomic) CGSize size;
-@property (nonatomic) CGRect oldFrame;
-@property (nonatomic, readonly) CGRect calculatedFrame;
+// How much the size changed when the update was applied, used to work out
+// where views were before the transaction
+@property (nonatomic) CGSize sizeDelta;
 @property (nonatomic) BOOL markedForInsertion;
 @property (nonatomic) BOOL markedForRemoval;
 @property (nonatomic) BOOL markedForUpdate;
-@property (nonatomic, strong) CAAnimation *animation;
-@property (nonatomic) CGFloat x;
-@property (nonatomic) CGFloat y;
+// An update that also asks the data source for a fresh view
+@property (nonatomic) BOOL markedForReload;
 @property (nonatomic) NSInteger index;
-@property (nonatomic, strong) NSString *indexString;
+// A move is a removal and an insertion, the insertion points back at the removal
+// and takes its size and view with it
+@property (nonatomic, strong) AHLayoutObject *movedFrom;
+// Position of a removal in the change list, noted as the edits are built so the
+// insertion finishing its move finds it without searching the list
+@property (nonatomic) NSUInteger editIndex;
+@property (nonatomic) unsigned char flags;
+// Insertions and removals can stand for a run of objects from index on, 1 by
+// default. An inserted run keeps its sizes in runSizes, the widths and then the
+// heights as doubles, and its objects all start out with flags.
+@property (nonatomic) NSUInteger length;
+@property (nonatomic, strong) NSData *runSizes;
 
 @end
 
 @implementation AHLayoutObject
 
-@synthesize oldFrame;
 @synthesize size;
-@synthesize x;
-@synthesize y;
-@synthesize animation;
+@synthesize sizeDelta;
 @synthesize markedForInsertion;
 @synthesize markedForRemoval;
 @synthesize markedForUpdate;
+@synthesize markedForReload;
 @synthesize index;
-@synthesize indexString;
+@synthesize movedFrom;
+@synthesize editIndex;
+@synthesize flags;
+@synthesize length;
+@synthesize runSizes;
+
+-(id) init {
+    self = [super init];
+    if (self) {
+        length = 1;
+    }
+    return self;
+}
+
+@end
+
+// Maps object indexes to the views on screen.
+// The views are kept in a ring buffer spanning the lowest to the highest
+// visible index, so lookups are a subtraction and a mask, and a table
+// from view back to index makes the reverse lookup O(1) as well.
+@interface AHLayoutViewMap : NSObject
+
+@property (nonatomic, readonly) NSUInteger count;
+// The span of indexes between the lowest and highest mapped view
+@property (nonatomic, readonly) NSRange indexRange;
+
+-(TUIView*) viewForIndex:(NSInteger) index;
+-(NSInteger) indexForView:(TUIView*) view;
+-(void) setView:(TUIView*) view forIndex:(NSInteger) index;
+-(void) removeViewForIndex:(NSInteger) index;
+-(void) removeAllViews;
+-(void) removeViewsOutsideRange:(NSRange) range usingBlock:(void (^)(NSInteger index, TUIView *view))block;
+// Enumerates in ascending index order
+-(void) enumerateViewsUsingBlock:(void (^)(NSInteger index, TUIView *view, BOOL *stop))block;
+-(NSArray*) allViews;
+
+@end
+
+@implementation AHLayoutViewMap {
+    NSMutableArray *slots;
+    NSUInteger head;
+    NSInteger firstIndex;
+    NSUInteger length;
+    NSMapTable *indexesByView;
+}
+
+@synthesize count;
+
+-(id) init {
+    self = [super init];
+    if (self) {
+        slots = [NSMutableArray array];
+        // Indexes are stored off by one so that index 0 is not mistaken for a missing entry
+        indexesByView = [[NSMapTable alloc] initWithKeyOptions:NSPointerFunctionsOpaqueMemory | NSPointerFunctionsObjectPointerPersonality
+                                                  valueOptions:NSPointerFunctionsOpaqueMemory | NSPointerFunctionsIntegerPersonality
+                                                      capacity:0];
+    }
+    return self;
+}
+
+-(NSRange) indexRange {
+    return NSMakeRange(length ? firstIndex : 0, length);
+}
+
+-(NSUInteger) slotForIndex:(NSInteger) index {
+    return (head + (index - firstIndex)) & (slots.count - 1);
+}
+
+-(BOOL) containsIndex:(NSInteger) index {
+    return length > 0 && index >= firstIndex && index < firstIndex + (NSInteger) length;
+}
+
+// Grow to the next power of two, unrolling the ring so that it starts at slot 0
+-(void) ensureCapacity:(NSUInteger) capacity {
+    if (capacity <= slots.count) return;
+    NSUInteger newCapacity = MAX(slots.count, 16);
+    while (newCapacity < capacity) newCapacity *= 2;
+    NSMutableArray *newSlots = [NSMutableArray arrayWithCapacity:newCapacity];
+    for (NSUInteger i = 0; i < length; i++) {
+        [newSlots addObject:[slots objectAtIndex:[self slotForIndex:firstIndex + i]]];
+    }
+    NSNull *hole = [NSNull null];
+    while (newSlots.count < newCapacity) [newSlots addObject:hole];
+    slots = newSlots;
+    head = 0;
+}
+
+-(TUIView*) viewForIndex:(NSInteger) index {
+    if (![self containsIndex:index]) return nil;
+    id v = [slots objectAtIndex:[self slotForIndex:index]];
+    return v == [NSNull null] ? nil : v;
+}
+
+-(NSInteger) indexForView:(TUIView*) view {
+    if (!view) return NSNotFound;
+    NSUInteger stored = (NSUInteger) NSMapGet(indexesByView, (__bridge void *) view);
+    return stored ? (NSInteger) stored - 1 : NSNotFound;
+}
+
+-(void) setView:(TUIView*) view forIndex:(NSInteger) index {
+    if (!view) {
+        [self removeViewForIndex:index];
+        return;
+    }
+    NSInteger previousIndex = [self indexForView:view];
+    if (previousIndex == index) return;
+    if (previousIndex != NSNotFound) [self removeViewForIndex:previousIndex];
+    [self removeViewForIndex:index];
+    
+    if (length == 0) {
+        [self ensureCapacity:1];
+        firstIndex = index;
+        head = 0;
+        length = 1;
+    } else if (index < firstIndex) {
+        NSUInteger grow = firstIndex - index;
+        [self ensureCapacity:length + grow];
+        head = (head + slots.count - (grow & (slots.count - 1))) & (slots.count - 1);
+        firstIndex = index;
+        length += grow;
+    } else if (index >= firstIndex + (NSInteger) length) {
+        NSUInteger newLength = index - firstIndex + 1;
+        [self ensureCapacity:newLength];
+        length = newLength;
+    }
+    [slots replaceObjectAtIndex:[self slotForIndex:index] withObject:view];
+    NSMapInsert(indexesByView, (__bridge void *) view, (void *) (index + 1));
+    count += 1;
+}
+
+-(void) removeViewForIndex:(NSInteger) index {
+    TUIView *v = [self viewForIndex:index];
+    if (!v) return;
+    NSNull *hole = [NSNull null];
+    [slots replaceObjectAtIndex:[self slotForIndex:index] withObject:hole];
+    NSMapRemove(indexesByView, (__bridge void *) v);
+    count -= 1;
+    
+    // Trim empty slots off both ends of the window
+    if (count == 0) {
+        length = 0;
+        return;
+    }
+    while ([slots objectAtIndex:head] == hole) {
+        head = (head + 1) & (slots.count - 1);
+        firstIndex += 1;
+        length -= 1;
+    }
+    while ([slots objectAtIndex:[self slotForIndex:firstIndex + length - 1]] == hole) {
+        length -= 1;
+    }
+}
+
+-(void) removeAllViews {
+    NSNull *hole = [NSNull null];
+    for (NSUInteger i = 0; i < length; i++) {
+        [slots replaceObjectAtIndex:[self slotForIndex:firstIndex + i] withObject:hole];
+    }
+    [indexesByView removeAllObjects];
+    length = 0;
+    count = 0;
+}
+
+// Views leave from the ends of the window as it scrolls, and the window is
+// trimmed to a view at either end after every removal, so this only visits
+// the views being removed
+-(void) removeViewsOutsideRange:(NSRange) range usingBlock:(void (^)(NSInteger index, TUIView *view))block {
+    NSInteger start = range.location;
+    NSInteger end = NSMaxRange(range);
+    while (count > 0 && firstIndex < start) {
+        NSInteger index = firstIndex;
+        TUIView *v = [self viewForIndex:index];
+        [self removeViewForIndex:index];
+        if (block) block(index, v);
+    }
+    while (count > 0 && firstIndex + (NSInteger) length > end) {
+        NSInteger index = firstIndex + length - 1;
+        TUIView *v = [self viewForIndex:index];
+        [self removeViewForIndex:index];
+        if (block) block(index, v);
+    }
+}
+
+-(void) enumerateViewsUsingBlock:(void (^)(NSInteger index, TUIView *view, BOOL *stop))block {
+    BOOL stop = NO;
+    NSInteger first = firstIndex;
+    NSUInteger span = length;
+    for (NSUInteger i = 0; i < span && !stop; i++) {
+        TUIView *v = [self viewForIndex:first + i];
+        if (v) block(first + i, v, &stop);
+    }
+}
+
+-(NSArray*) allViews {
+    NSMutableArray *views = [NSMutableArray arrayWithCapacity:count];
+    [self enumerateViewsUsingBlock:^(NSInteger index, TUIView *view, BOOL *stop) {
+        [views addObject:view];
+    }];
+    return views;
+}
+
+@end
+
+// Views waiting to be reused under one reuse identifier
+@interface AHLayoutReusePool : NSObject
+
+@property (nonatomic, strong) Class viewClass;
+@property (nonatomic, readonly) NSMutableArray *views;
+@property (nonatomic) NSUInteger maximumCount;
+@property (nonatomic) NSUInteger hits;
+@property (nonatomic) NSUInteger misses;
+@property (nonatomic) NSUInteger discards;
 
--(CGRect) calculatedFrame {
-    return CGRectMake(self.x, self.y, self.size.width, self.size.height);
+@end
+
+@implementation AHLayoutReusePool
+
+@synthesize viewClass;
+@synthesize views;
+@synthesize maximumCount;
+@synthesize hits;
+@synthesize misses;
+@synthesize discards;
+
+-(id) init {
+    self = [super init];
+    if (self) {
+        views = [NSMutableArray array];
+        maximumCount = kAHLayoutDefaultMaximumReusableViews;
+    }
+    return self;
+}
+
+// Drop views off the end of the pool until it holds at most count
+-(void) trimToCount:(NSUInteger) count {
+    if (views.count <= count) return;
+    discards += views.count - count;
+    [views removeObjectsInRange:NSMakeRange(count, views.count - count)];
 }
 
 @end
@@ -67,14 +394,51 @@
 
 @interface AHLayout()
 
-@property (nonatomic, strong) NSMutableDictionary *objectViewsMap;
+@property (nonatomic, strong) AHLayoutViewMap *objectViewsMap;
 @property (nonatomic, readonly) AHLayoutTransaction *updatingTransaction;
 @property (nonatomic, strong) AHLayoutTransaction *executingTransaction;
-@property (nonatomic, strong) NSMutableArray *objects;
+@property (nonatomic, readonly) AHLayoutOffsetIndex *offsetIndex;
+// The geometry core, sized to the current bounds
+@property (nonatomic, readonly) AHLayoutCore *core;
+@property (nonatomic) BOOL needsMeasuring;
+@property (nonatomic, readonly) BOOL estimatingSizes;
+// Statistics of the executing transaction until it reports them, NULL unless collecting
+@property (nonatomic, readonly) AHLayoutTransactionStatistics *runningStatistics;
+// Counted towards instead of the executing transaction while set, for a
+// retargeted transaction wrapping up
+@property (nonatomic, weak) AHLayoutTransaction *countingTransaction;
 
 -(void) executeNextLayoutTransaction;
+-(AHLayoutTransaction*) waitingTransaction;
+-(NSInteger) numberOfViewsAfterQueuedUpdates;
+-(void) measureObjects;
+-(BOOL) needsMeasuringForBounds:(CGRect) bounds;
+-(BOOL) measureObjectsInRange:(NSRange) range;
+-(void) objectsChangedFromIndex:(NSUInteger) index;
+-(void) objectResizedAtIndex:(NSUInteger) index;
+-(void) reloadSections;
+-(void) setSectionLeadsEnabled:(BOOL) enabled;
+-(void) addChangesForInsertions:(NSIndexSet*) insertions deletions:(NSIndexSet*) deletions reloads:(NSIndexSet*) reloads moves:(NSDictionary*) moves;
+-(void) addChangeForInsertionOfRange:(NSRange) range;
+-(void) addChangeForRemovalOfRange:(NSRange) range;
+-(CGPoint) contentOffsetForAnchor:(AHLayoutAnchor) anchor;
+-(void) updateScrollSpeed;
+-(void) updatePrefetching;
+-(CGRect) overscanRectForVisibleRect:(CGRect) visible;
+-(void) cancelPrefetching;
+-(void) layoutHeadersInRect:(CGRect) rect objectRange:(NSRange) range;
+-(void) copySizesConcurrentlyWithCount:(NSUInteger) count widths:(double*) widths heights:(double*) heights;
+-(BOOL) usesSizeCache;
+-(uint64_t) sizeCacheKeyForIndex:(NSUInteger) index;
+-(CGFloat) sizeCacheCrossExtent;
+-(void) copyCachedSizesWithCount:(NSUInteger) count widths:(double*) widths heights:(double*) heights measuredIndexes:(NSMutableIndexSet*) measuredIndexes;
+-(void) enumerateObjectFramesInRange:(NSRange) range usingBlock:(void (^)(NSUInteger index, CGRect frame, BOOL *stop))block;
 - (void) enqueueReusableView:(TUIView *)view;
-- (TUIView *)createView;
+- (TUIView *)createViewWithIdentifier:(NSString *)identifier;
+- (AHLayoutReusePool *)reusePoolForIdentifier:(NSString *)identifier;
+-(void) handleMemoryPressure:(unsigned long) level;
+-(AHLayoutTransactionStatistics) takePendingTransactionStatistics;
+-(void) reportTransactionStatistics:(AHLayoutTransactionStatistics) statistics;
 
 @end
 
@@ -94,6 +458,8 @@ typedef enum {
 @property (nonatomic) BOOL shouldAnimate;
 @property (nonatomic) CGSize contentSize;
 @property (nonatomic) CGRect nextVisibleRect;
+// nextVisibleRect with the layout's overscan, views are kept for this rect
+@property (nonatomic) CGRect nextBufferedRect;
 @property (nonatomic) AHLayoutTransactionPhase phase;
 @property (nonatomic) NSInteger scrollToObjectIndex;
 @property (nonatomic, strong) NSMutableArray *changeList;
@@ -102,39 +468,75 @@ typedef enum {
 @property (nonatomic) CGFloat animationDuration;
 @property (nonatomic) CGPoint contentOffset;
 @property (nonatomic) BOOL maintainContentOffset;
+// Don't ask the data source for sizes while the change list is applied, the
+// caller may have updated its model already. Cleared once the changes are in.
 @property (nonatomic) BOOL shouldNotCallDelegate;
+// Started while another transaction was animating, the views start out from
+// where that animation has them on screen
+@property (nonatomic) BOOL retargeting;
+// Animating when a newer transaction took its views over
+@property (nonatomic) BOOL retargeted;
+// Keep the first object on screen where it is through the changes
+@property (nonatomic) BOOL keepsAnchor;
+// Objects still flagged as inserted once the change list is applied, including
+// those of a transaction this one retargeted, cleared when the animation ends
+@property (nonatomic, strong) NSMutableIndexSet *insertedIndexes;
 
 -(void) applyLayout;
 -(void) addCompletionBlock:(AHLayoutHandler) block;
+-(AHLayoutTransactionStatistics*) runningStatistics;
+-(void) reportStatistics;
 
 -(CGPoint) calculateNextContentOffset;
+-(void) measureObjectsIfNeeded;
+-(void) measureVisibleObjects;
 -(void) calculateContentSize;
 - (CGPoint)modifyContentOffset:(CGPoint)c forRect:(CGRect)rect inVisibleRect:(CGRect) visible horizontal:(BOOL)horizontal;
 -(void) calculateNextVisibleRect;
--(void) calculateObjectOffsets;
--(void) calculateObjectOffsetsVertical;
--(void) calculateObjectOffsetsHorizontal;
+-(CGRect) oldFrameForIndex:(NSInteger) index;
+-(void) recordOldFrameDeltas;
 
--(NSMutableArray *)objectIndexesInRect:(CGRect)rect;
--(NSString*) indexKeyForObject:(AHLayoutObject*) object;
+-(NSRange) objectRangeInRect:(CGRect)rect;
+-(NSArray*) masonryIndexesInRect:(CGRect) rect;
+-(NSIndexSet*) objectIndexesInRect:(CGRect) rect;
 
 -(void) moveViews;
 -(void) addNewlyVisibleSubviews;
--(TUIView*) addSubviewForObject:(AHLayoutObject*) object atIndex:(NSString*) objectIndex;
+-(TUIView*) addSubviewAtIndex:(NSInteger) index;
 -(void) rebaseForInsertionsAndRemovals;
+-(void) recordAnchor;
 -(void) processChangeList;
+-(void) clearInsertedFlags;
 -(void) cleanup;
--(void) moveObjectsAfterPoint:(CGPoint) point byIndexAmount:(NSInteger) indexAmount;
+-(NSData*) changeListEdits;
+-(void) mergeTransaction:(AHLayoutTransaction*) transaction;
+-(NSInteger) pendingCountChange;
+-(void) adoptPresentationFrames;
 @end
 
 @implementation AHLayoutTransaction {
     NSMutableArray *completionBlocks;
     BOOL calculatedContentSize;
-    NSMutableArray *objectIndexesToBringIntoView;
+    NSRange objectRangeToBringIntoView;
     BOOL shouldChangeContentOffset;
     BOOL preLayoutPass;
     CGRect lastBounds;
     NSMutableArray *viewsToRemove;
+    BOOL processedChangeList;
+    // When the current phase of an animated transaction started
+    CFTimeInterval phaseStart;
+    // The object kept in place by keepsAnchor
+    AHLayoutAnchor anchor;
+    // Where the last layout pass left the screen, kept through resizes
+    AHLayoutAnchor lastAnchor;
+    // The resizes of the change list by object, sorted, nil unless every change is a resize
+    NSData *oldFrameDeltas;
+    CGFloat oldFrameTotalDelta;
+    // Where the reloaded objects are once the change list is applied
+    NSMutableIndexSet *reloadedIndexes;
+    // Counted from the first pass until the transaction finishes, reported once
+    AHLayoutTransactionStatistics transactionStatistics;
+    BOOL reportedStatistics;
 }
 
 @synthesize layout;
@@ -142,6 +544,7 @@ typedef enum {
 @synthesize shouldAnimate;
 @synthesize contentSize;
 @synthesize nextVisibleRect;
+@synthesize nextBufferedRect;
 @synthesize phase;
 @synthesize scrollToObjectIndex;
 @synthesize changeList;
@@ -156,6 +559,8 @@ typedef enum {
     self = [super init];
     if (self) {
         scrollToObjectIndex = -1;
+        anchor.index = NSNotFound;
+        lastAnchor.index = NSNotFound;
     }
     return self;
 }
@@ -175,6 +580,26 @@ typedef enum {
     return changeList;
 }
 
+-(NSMutableIndexSet*) insertedIndexes {
+    if (!_insertedIndexes) {
+        _insertedIndexes = [NSMutableIndexSet indexSet];
+    }
+    return _insertedIndexes;
+}
+
+#pragma mark - Statistics
+
+// NULL once reported, the passes after that only scroll
+-(AHLayoutTransactionStatistics*) runningStatistics {
+    return layout.collectsTransactionStatistics && !reportedStatistics ? &transactionStatistics : NULL;
+}
+
+-(void) reportStatistics {
+    if (![self runningStatistics]) return;
+    reportedStatistics = YES;
+    [layout reportTransactionStatistics:transactionStatistics];
+}
+
 #pragma mark - Layout
 
 
@@ -194,33 +619,24 @@ typedef enum {
     // save off some current offset info
     CGFloat previousYOffset = self.layout.contentSize.height + self.layout.contentOffset.y;
     CGFloat previousXOffset =  self.layout.contentSize.width + self.layout.contentOffset.x;
-    CGFloat relativeOffset = 0.0f;
-    NSInteger savedIndex = -1;
-    if (layout.objects.count > 0 && [self.layout.nsView inLiveResize]) {
-        savedIndex = [layout objectIndexAtTopOfScreen];
-        if (savedIndex >=0) {
-            CGRect v = [self.layout visibleRect];
-            CGRect r = [self.layout rectForViewAtIndex:savedIndex];
-            if (layout.typeOfLayout == AHLayoutHorizontal) {
-                relativeOffset = ((v.origin.x + v.size.width) - (r.origin.x + r.size.width));
-                relativeOffset += (lastBounds.size.width - bounds.size.width);
-                relativeOffset += resizingXOffset;
-            } else {
-                relativeOffset = ((v.origin.y + v.size.height) - (r.origin.y + r.size.height));
-                relativeOffset += (lastBounds.size.height - bounds.size.height);
-                relativeOffset += resizingYOffset;
-            }
-        }
+    // The bounds have already changed, so the anchor is the one taken at the
+    // end of the last pass, before the resize
+    AHLayoutAnchor resizeAnchor = {NSNotFound, 0};
+    if (layout.numberOfViews > 0 && [self.layout.nsView inLiveResize] && !CGSizeEqualToSize(bounds.size, lastBounds.size)) {
+        resizeAnchor = lastAnchor;
     }
     
     
+    AHLayoutTransactionStatistics *runningStatistics = [self runningStatistics];
+    if (runningStatistics) {
+        AHAddTransactionStatistics(runningStatistics, [layout takePendingTransactionStatistics]);
+    }
+    CFTimeInterval start = runningStatistics ? CACurrentMediaTime() : 0;
     if (!calculated || !CGSizeEqualToSize(bounds.size, lastBounds.size)) {
-        if (!self.shouldNotCallDelegate) {
-            self.contentSize = CGSizeZero; //reset the contentSize
-        }
-        [self calculateContentSize];
+        [self measureObjectsIfNeeded];
+        [self recordAnchor];
         [self processChangeList];
-        [self calculateObjectOffsets];
+        [self calculateContentSize];
         calculated = YES;
     }
     lastBounds = bounds;
@@ -230,6 +646,7 @@ typedef enum {
         if (phase == AHLayoutTransactionPhaseNormal) {
             phase = AHLayoutTransactionPhasePrelayout;
             self.shouldAnimate = NO;
+            phaseStart = start;
             
             // Perform a prelayout transaction where we bring in needed subviews
             // into their old location so that the animations looks ok
@@ -240,28 +657,57 @@ typedef enum {
                 
                 // In this CATransaction we animate the layout
                 weakSelf.phase = AHLayoutTransactionPhaseAnimating;
+                AHLayoutTransactionStatistics *statistics = [weakSelf runningStatistics];
+                if (statistics) {
+                    CFTimeInterval now = CACurrentMediaTime();
+                    statistics->animated = YES;
+                    statistics->prelayoutTime += now - phaseStart;
+                    phaseStart = now;
+                }
                 [CATransaction begin];
                 [CATransaction setCompletionBlock:^{
+                    AHLayoutTransactionStatistics *statistics = [weakSelf runningStatistics];
+                    if (statistics) {
+                        CFTimeInterval now = CACurrentMediaTime();
+                        statistics->animatingTime += now - phaseStart;
+                        phaseStart = now;
+                    }
                     if (changeList.count > 0) {
                         for (AHLayoutObject *object in changeList) {
                             object.markedForInsertion = NO;
                             object.markedForRemoval = NO;
                             object.markedForUpdate = NO;
+                            object.markedForReload = NO;
                         }
                         [changeList removeAllObjects];
                     }
+                    // Once retargeted, the views and flags belong to the newer transaction
+                    if (!weakSelf.retargeted) {
+                        [weakSelf clearInsertedFlags];
+                    }
                     weakSelf.phase = AHLayoutTransactionPhaseNormal;
                     shouldAnimate = NO;
+                    // The changes are in, the passes this transaction keeps running measure as usual
+                    weakSelf.shouldNotCallDelegate = NO;
                     if (viewsToRemove.count > 0) {
+                        // Recycling its views is this transaction's work, not the newer one's
+                        weakSelf.layout.countingTransaction = weakSelf;
                         for (TUIView *v in viewsToRemove) {
                             [v removeFromSuperview];
                             [self.layout enqueueReusableView:v];
                         }
+                        weakSelf.layout.countingTransaction = nil;
                     }
-                    if (!CGRectEqualToRect(layout.visibleRect, nextVisibleRect)) {
+                    if (!weakSelf.retargeted && !CGRectEqualToRect(layout.visibleRect, nextVisibleRect)) {
                         NSLog(@"Visible rect calculation is wrong\nTransaction: %@\nLayout: %@", NSStringFromRect(nextVisibleRect), NSStringFromRect(layout.visibleRect));
                     }
                     for (AHLayoutHandler block in weakCompletionBlocks) block(weakSelf.layout);
+                    // Its own statistics, even if a newer transaction has taken over
+                    statistics = [weakSelf runningStatistics];
+                    if (statistics) {
+                        statistics->doneAnimatingTime += CACurrentMediaTime() - phaseStart;
+                        [weakSelf reportStatistics];
+                    }
                 }];
                 
                 CGFloat duration = weakSelf.animationDuration > 0 ? weakSelf.animationDuration :  kAHLayoutDefaultAnimationDuration;
@@ -280,26 +726,26 @@ typedef enum {
             }];
             
             
-            // Process insertions and removals
-            [weakSelf rebaseForInsertionsAndRemovals];
-            
-            AHLayoutObject *scrollToObject = nil;
-            if (scrollToObjectIndex >= 0 && layout.objects.count > scrollToObjectIndex) {
-                scrollToObject = [layout.objects objectAtIndex:scrollToObjectIndex];
-            }
+            if (self.retargeting) [self adoptPresentationFrames];
             
             contentOffset = layout.contentOffset;
             [self calculateNextVisibleRect];
             // Now refine the contentOffset a bit more to make sure we scroll to the right object
-            if (scrollToObject) {
+            if (scrollToObjectIndex >= 0 && layout.numberOfViews > scrollToObjectIndex) {
                 // scroll the view to bottom or left
-                CGRect r = scrollToObject.calculatedFrame;
+                CGRect r = [layout rectForViewAtIndex:scrollToObjectIndex];
                 contentOffset = self.layout.typeOfLayout == AHLayoutHorizontal ? CGPointMake(-r.origin.x, 0) : CGPointMake(0, -r.origin.y);
+            } else if (anchor.index != NSNotFound && anchor.index < (NSUInteger)layout.numberOfViews) {
+                contentOffset = [layout contentOffsetForAnchor:anchor];
             }
             contentOffset = [self fixContentOffset:contentOffset forSize:contentSize inBounds:layout.bounds];
             [self calculateNextVisibleRect];
             
-            objectIndexesToBringIntoView = [self objectIndexesInRect:nextVisibleRect];
+            // Process insertions and removals, once the rect they animate to is known
+            [weakSelf rebaseForInsertionsAndRemovals];
+            [self measureVisibleObjects];
+            
+            objectRangeToBringIntoView = [self objectRangeInRect:nextBufferedRect];
             
             // Bring in any needed views needed for the animation
             // Existing subviews will come in using their old frames
@@ -312,21 +758,7 @@ typedef enum {
     } else {
         [TUIView setAnimationsEnabled:NO block:^{
             // maintain position after new layout
-            if (savedIndex >=0 && relativeOffset >= 0) {
-                CGRect v = [self.layout visibleRect];
-				CGRect r = [self.layout rectForViewAtIndex:savedIndex];
-                if (layout.typeOfLayout == AHLayoutHorizontal) {
-                    r.origin.x -= (v.size.width - r.size.width);
-                    r.size.width += (v.size.width - r.size.width);
-                    r.origin.x += relativeOffset;
-                }  else {
-                    r.origin.y -= (v.size.height - r.size.height);
-                    r.size.height += (v.size.height - r.size.height);
-                    r.origin.y += relativeOffset;
-                }
-				[self.layout scrollRectToVisible:r animated:NO];
-            }
-            else if (self.maintainContentOffset) {
+            if (resizeAnchor.index == NSNotFound && self.maintainContentOffset) {
                 if (layout.typeOfLayout == AHLayoutHorizontal) {
                     CGFloat newOffset = previousXOffset - self.contentSize.width - resizingXOffset;
                     self.contentOffset = CGPointMake(newOffset, self.layout.contentOffset.y);
@@ -337,76 +769,108 @@ typedef enum {
             }
             
             layout.contentSize = contentSize;
-            if (!layout.didFirstLayout && (layout.objects.count > 0)) {
+            if (resizeAnchor.index != NSNotFound) {
+                layout.contentOffset = [self fixContentOffset:[layout contentOffsetForAnchor:resizeAnchor] forSize:contentSize inBounds:layout.bounds];
+            }
+            if (!layout.didFirstLayout && (layout.numberOfViews > 0)) {
                 [layout scrollToTopAnimated:NO];
                 layout.didFirstLayout = YES;
             }
             [self calculateNextVisibleRect];
+            [self measureVisibleObjects];
             
-            objectIndexesToBringIntoView = [self objectIndexesInRect:nextVisibleRect];
+            objectRangeToBringIntoView = [self objectRangeInRect:nextBufferedRect];
+            // Recycle the views scrolled away first so the new ones can reuse them
+            [self cleanup];
             [self addNewlyVisibleSubviews];
             [self moveViews];
-            [self cleanup];
+            lastAnchor = layout.anchor;
         }];
+        // Only the pass applying the change list skips the data source
+        if (processedChangeList) self.shouldNotCallDelegate = NO;
+        // An unanimated transaction is done after its first pass, one still
+        // animating reports once the animation ends. Later passes only scroll
+        // and count towards nothing.
+        if (runningStatistics && phase == AHLayoutTransactionPhaseNormal) {
+            runningStatistics->layoutTime += CACurrentMediaTime() - start;
+            [self reportStatistics];
+        } else if (!runningStatistics && layout.collectsTransactionStatistics) {
+            [layout takePendingTransactionStatistics];
+        }
     }
     
 }
 
 - (void) addNewlyVisibleSubviews {
-    
-    // Process objects that need to be brought into view view
-    NSMutableArray *objectIndexesToAdd = [objectIndexesToBringIntoView mutableCopy];
-	[objectIndexesToAdd removeObjectsInArray:[layout.objectViewsMap allKeys]];
-    
-    // Remove any objects marked for insertion or deletion
-    // These will be handled separately
-    if (shouldAnimate && [changeList count] > 0) {
-        for (AHLayoutObject * object in changeList) {
-            if (object.markedForInsertion || object.markedForRemoval) {
-                NSString *objectIndex = [NSString stringWithFormat:@"%ld", object.index];;
-                [objectIndexesToAdd removeObject:objectIndex];
-            }
+    if (layout.typeOfLayout == AHLayoutMasonry) {
+        // The run of a masonry layout can reach far off screen, only the
+        // items actually in the buffered rect get a view
+        for (NSNumber *index in [self masonryIndexesInRect:nextBufferedRect]) {
+            NSUInteger i = [index unsignedIntegerValue];
+            if (i >= (NSUInteger)layout.numberOfViews || [layout viewForIndex:i]) continue;
+            [self addSubviewAtIndex:i];
         }
+        return;
     }
-    
-	for (NSString *objectIndex in objectIndexesToAdd) {
-        AHLayoutObject *object = [layout.objects objectAtIndex:[objectIndex intValue]];
-        [self addSubviewForObject:object atIndex:objectIndex];
+    // Process objects that need to be brought into view, this includes
+    // inserted objects once the views on screen have been rebased
+    NSUInteger start = objectRangeToBringIntoView.location;
+    NSUInteger end = MIN(NSMaxRange(objectRangeToBringIntoView), (NSUInteger)layout.numberOfViews);
+    NSRange mapRange = layout.objectViewsMap.indexRange;
+    if (mapRange.length > 0 && layout.objectViewsMap.count == mapRange.length && start < NSMaxRange(mapRange) && end > mapRange.location) {
+        // Every index the map spans has a view, so only the ends that
+        // scrolled into view need any
+        for (NSUInteger index = start; index < mapRange.location; index++) {
+            [self addSubviewAtIndex:index];
+        }
+        for (NSUInteger index = NSMaxRange(mapRange); index < end; index++) {
+            [self addSubviewAtIndex:index];
+        }
+        return;
+    }
+	for (NSUInteger index = start; index < end; index++) {
+        if ([layout viewForIndex:index]) continue;
+        [self addSubviewAtIndex:index];
     }
 }
 
--(TUIView*) addSubviewForObject:(AHLayoutObject*) object atIndex:(NSString*) objectIndex {
+-(TUIView*) addSubviewAtIndex:(NSInteger) index {
     
-    if([layout.objectViewsMap objectForKey:objectIndex]  && !object.markedForInsertion) {
-        NSLog(@"!!! Warning: already have a view in place for index %ld", object.index);
+    BOOL inserted = (AHLayoutOffsetIndexGetFlags(layout.offsetIndex, index) & AHLayoutObjectFlagInserted) != 0;
+    if([layout.objectViewsMap viewForIndex:index]  && !inserted) {
+        NSLog(@"!!! Warning: already have a view in place for index %ld", index);
     } else {
-        NSInteger index = [objectIndex integerValue];
         TUIView * v = [layout.dataSource layout:layout viewForIndex:index];
         v.tag = index;
+        AHLayoutTransactionStatistics *statistics = layout.runningStatistics;
+        if (statistics) {
+            statistics->dataSourceCalls++;
+            statistics->viewsLaidOut++;
+        }
         AHLayoutTransactionPhase thePhase = self.phase;
         [TUIView setAnimationsEnabled:NO block:^{
+            CGRect oldFrame = CGRectZero;
             if (thePhase == AHLayoutTransactionPhasePrelayout) {
-                if (!CGRectIsNull(object.oldFrame)  && !CGRectEqualToRect(CGRectZero, object.oldFrame)) {
-                    //Bring subviews in under their oldFrame in the last transaction
-                    v.frame = object.oldFrame;
-                } else {
-                    v.frame = object.calculatedFrame;
-                }
+                oldFrame = [self oldFrameForIndex:index];
+            }
+            if (!CGRectEqualToRect(CGRectZero, oldFrame)) {
+                //Bring subviews in under their oldFrame in the last transaction
+                v.frame = oldFrame;
             } else {
-                v.frame = object.calculatedFrame;
+                v.frame = [layout rectForViewAtIndex:index];
             }
         }];
         
         // Only add subviews if they are on screen
         if (!v.superview) {
-            if (object.markedForInsertion) {
+            if (inserted) {
                 if (self.viewAnimationBlock) {
                     self.viewAnimationBlock(self.layout, v);
                 }
             }
             [layout addSubview:v];
         }
-        [layout.objectViewsMap setObject:v forKey:objectIndex];
+        [layout.objectViewsMap setView:v forIndex:index];
         [v layoutSubviews];
         [v setNeedsDisplay];
         return v;
@@ -414,149 +878,432 @@ typedef enum {
     return nil;
 }
 
+// Take the anchor before the changes are applied, and follow its object to
+// where it will be after them
+-(void) recordAnchor {
+    if (!self.keepsAnchor || processedChangeList) return;
+    anchor = layout.anchor;
+    if (anchor.index == NSNotFound) return;
+    size_t index = AHLayoutEditsPositionAfter([[self changeListEdits] bytes], [changeList count], anchor.index);
+    anchor.index = index == AHLayoutNotFound ? NSNotFound : index;
+}
+
+// Move the views on screen to the indexes their objects have after the change list,
+// in one walk over the changes for all of them rather than one per view, and
+// recycle the views of reloaded objects where processChangeList left them.
+// Views for inserted objects are brought in afterwards with the rest of the
+// newly visible views.
+// Views that end up far from the buffered rect, moved to a distant index or
+// pushed away by a long insertion, are recycled rather than spreading the
+// view map across the gap.
 -(void) rebaseForInsertionsAndRemovals {
-    if ([changeList count] > 0) {
-        for (AHLayoutObject *object in changeList) {
-            TUIView *v = [layout viewForIndex:object.index];
-            if (object.markedForInsertion || object.markedForRemoval) {
-                NSInteger moveAmount =  object.markedForInsertion ? 1 : -1;
-                [self moveObjectsAfterPoint:object.calculatedFrame.origin byIndexAmount:moveAmount];
+    if ([changeList count] == 0) return;
+    NSData *edits = [self changeListEdits];
+    
+    NSMutableArray *views = [NSMutableArray arrayWithCapacity:layout.objectViewsMap.count];
+    NSMutableData *indexData = [NSMutableData dataWithLength:layout.objectViewsMap.count * sizeof(size_t)];
+    size_t *indexes = [indexData mutableBytes];
+    [layout.objectViewsMap enumerateViewsUsingBlock:^(NSInteger index, TUIView *v, BOOL *stop) {
+        indexes[views.count] = index;
+        [views addObject:v];
+    }];
+    [layout.objectViewsMap removeAllViews];
+    // The views come out in index order, so one walk over the change list
+    // moves them all
+    size_t *newIndexes = [[NSMutableData dataWithBytes:indexes length:views.count * sizeof(size_t)] mutableBytes];
+    AHLayoutEditsRebasePositions([edits bytes], [changeList count], newIndexes, views.count);
+    
+    // Views within as many indexes of the buffered range as there are views can
+    // still animate in or out of sight, the rest are too far to be seen moving
+    NSRange bufferedRange = [self objectRangeInRect:nextBufferedRect];
+    NSUInteger reach = views.count;
+    NSUInteger keepFrom = bufferedRange.location > reach ? bufferedRange.location - reach : 0;
+    NSUInteger keepTo = NSMaxRange(bufferedRange) + reach;
+    
+    [views enumerateObjectsUsingBlock:^(TUIView *v, NSUInteger i, BOOL *stop) {
+        size_t oldIndex = indexes[i], newIndex = newIndexes[i];
+        if (newIndex == AHLayoutNotFound) {
+            if (self.viewAnimationBlock) {
+                self.viewAnimationBlock(self.layout, v);
+            } else {
+                v.alpha = 0.1;
             }
-            if (object.markedForInsertion) {
-                [self addSubviewForObject:object atIndex:object.indexString];
+            if (!viewsToRemove) {
+                viewsToRemove = [NSMutableArray array];
             }
-            if (object.markedForRemoval) {
-                if (v) {
-                    if (self.viewAnimationBlock) {
-                        self.viewAnimationBlock(self.layout, v);
-                    } else {
-                        v.alpha = 0.1;
-                    }
-                    if (!viewsToRemove) {
-                        viewsToRemove = [NSMutableArray array];
-                    }
-                    [viewsToRemove addObject:v];
-                }
+            [viewsToRemove addObject:v];
+        } else if ([reloadedIndexes containsIndex:newIndex] || newIndex < keepFrom || newIndex >= keepTo) {
+            // A fresh view comes in with the newly visible ones if needed
+            [v removeFromSuperview];
+            [layout enqueueReusableView:v];
+        } else {
+            [layout.objectViewsMap setView:v forIndex:newIndex];
+            if (newIndex != oldIndex) {
+                [v setTag:newIndex];
+                [v setNeedsDisplay];
             }
         }
-    }
+    }];
 }
 
 -(void) processChangeList {
-    if ([changeList count] > 0) {
-        for (AHLayoutObject *object in changeList) {
-            if (object.markedForUpdate) {
-                [layout.objects replaceObjectAtIndex:object.index withObject:object];
-            } else if (object.markedForRemoval) {
-                [layout.objects removeObjectAtIndex:object.index];
-                for (NSInteger i = object.index; i < layout.objects.count; i++) {
-                    [[layout.objects objectAtIndex:i] setIndex:i];
-                }
-            } else if (object.markedForInsertion) {
-                [layout.objects insertObject:object atIndex:object.index];
-                for (NSInteger i = object.index+1; i < layout.objects.count; i++) {
-                    [[layout.objects objectAtIndex:i] setIndex:i];
-                }
-            }
+    // Changes are applied once, even if the bounds change while the transaction runs
+    if (processedChangeList) return;
+    processedChangeList = YES;
+    AHLayoutOffsetIndex *offsetIndex = layout.offsetIndex;
+    // Each change is applied in order against the indexes left by the ones before it,
+    // so nothing else needs renumbering
+    // Header room sits on the first item of each section, which edits can change
+    [layout setSectionLeadsEnabled:NO];
+    NSMutableIndexSet *inserted = self.insertedIndexes;
+    // Followed through the changes after them like the inserted objects
+    reloadedIndexes = [NSMutableIndexSet indexSet];
+    BOOL edited = NO;
+    for (AHLayoutObject *object in changeList) {
+        NSInteger count = AHLayoutOffsetIndexCount(offsetIndex);
+        edited = edited || !object.markedForUpdate;
+        if (object.markedForUpdate) {
+            if (object.index >= count) continue;
+            double width, height;
+            AHLayoutOffsetIndexGetSize(offsetIndex, object.index, &width, &height);
+            object.sizeDelta = CGSizeMake(object.size.width - width, object.size.height - height);
+            AHLayoutOffsetIndexSetSize(offsetIndex, object.index, object.size.width, object.size.height);
+            AHLayoutOffsetIndexSetFlags(offsetIndex, object.index, AHLayoutOffsetIndexGetFlags(offsetIndex, object.index) | AHLayoutObjectFlagMeasured);
+            if (object.markedForReload) [reloadedIndexes addIndex:object.index];
+            [layout objectResizedAtIndex:object.index];
+        } else if (object.markedForRemoval && object.length > 1) {
+            if (object.index >= count) continue;
+            NSUInteger length = MIN(object.length, count - object.index);
+            AHLayoutOffsetIndexRemoveRange(offsetIndex, object.index, length);
+            [inserted removeIndexesInRange:NSMakeRange(object.index, length)];
+            [inserted shiftIndexesStartingAtIndex:object.index + length by:-(NSInteger)length];
+            [reloadedIndexes removeIndexesInRange:NSMakeRange(object.index, length)];
+            [reloadedIndexes shiftIndexesStartingAtIndex:object.index + length by:-(NSInteger)length];
+            [layout objectsChangedFromIndex:object.index];
+        } else if (object.markedForRemoval) {
+            if (object.index >= count) continue;
+            // Keep the size of a moving object for its insertion
+            double width, height;
+            AHLayoutOffsetIndexGetSize(offsetIndex, object.index, &width, &height);
+            object.size = CGSizeMake(width, height);
+            object.flags = AHLayoutOffsetIndexGetFlags(offsetIndex, object.index) & ~AHLayoutObjectFlagInserted;
+            if ([reloadedIndexes containsIndex:object.index]) object.flags |= AHLayoutObjectFlagReloaded;
+            AHLayoutOffsetIndexRemove(offsetIndex, object.index);
+            [inserted removeIndex:object.index];
+            [inserted shiftIndexesStartingAtIndex:object.index + 1 by:-1];
+            [reloadedIndexes removeIndex:object.index];
+            [reloadedIndexes shiftIndexesStartingAtIndex:object.index + 1 by:-1];
+            [layout objectsChangedFromIndex:object.index];
+        } else if (object.markedForInsertion && object.runSizes) {
+            if (object.index > count) continue;
+            const double *widths = [object.runSizes bytes];
+            AHLayoutOffsetIndexInsertRange(offsetIndex, object.index, object.length, widths, widths + object.length, object.flags);
+            [inserted shiftIndexesStartingAtIndex:object.index by:object.length];
+            [reloadedIndexes shiftIndexesStartingAtIndex:object.index by:object.length];
+            if (object.flags & AHLayoutObjectFlagInserted) [inserted addIndexesInRange:NSMakeRange(object.index, object.length)];
+            [layout objectsChangedFromIndex:object.index];
+        } else if (object.markedForInsertion) {
+            if (object.index > count) continue;
+            AHLayoutObject *source = object.movedFrom;
+            CGSize size = source ? source.size : object.size;
+            AHLayoutOffsetIndexInsert(offsetIndex, object.index, size.width, size.height);
+            [layout objectsChangedFromIndex:object.index];
+            unsigned char flags = source ? source.flags : AHLayoutObjectFlagInserted | AHLayoutObjectFlagMeasured;
+            AHLayoutOffsetIndexSetFlags(offsetIndex, object.index, flags & ~AHLayoutObjectFlagReloaded);
+            [inserted shiftIndexesStartingAtIndex:object.index by:1];
+            if (!source) [inserted addIndex:object.index];
+            [reloadedIndexes shiftIndexesStartingAtIndex:object.index by:1];
+            if (flags & AHLayoutObjectFlagReloaded) [reloadedIndexes addIndex:object.index];
+        }
+    }
+    // Which section an inserted or moved object joins is up to the data source,
+    // so its counts are asked for again, O(sections)
+    if (edited) {
+        [layout reloadSections];
+    } else {
+        [layout setSectionLeadsEnabled:YES];
+    }
+    [self recordOldFrameDeltas];
+}
+
+// Clears the inserted flag on the objects this transaction inserted, rather
+// than sweeping every object
+-(void) clearInsertedFlags {
+    AHLayoutOffsetIndex *offsetIndex = layout.offsetIndex;
+    NSUInteger count = AHLayoutOffsetIndexCount(offsetIndex);
+    [self.insertedIndexes enumerateIndexesUsingBlock:^(NSUInteger index, BOOL *stop) {
+        if (index >= count) {
+            *stop = YES;
+            return;
+        }
+        unsigned char flags = AHLayoutOffsetIndexGetFlags(offsetIndex, index);
+        if (flags & AHLayoutObjectFlagInserted) AHLayoutOffsetIndexSetFlags(offsetIndex, index, flags & ~AHLayoutObjectFlagInserted);
+    }];
+    [self.insertedIndexes removeAllIndexes];
+}
+
+// Where the object at index was before this transaction's resizes were applied.
+// Undoes the recorded size changes instead of keeping an old frame per object,
+// O(log changes). Returns CGRectZero when there is no meaningful old frame,
+// such as after insertions and removals.
+-(CGRect) oldFrameForIndex:(NSInteger) index {
+    if (!processedChangeList || !oldFrameDeltas) return CGRectZero;
+    // A resize can move views onto other rows of a flow layout, and
+    // undoing one in a masonry layout would mean finding its column
+    if (layout.typeOfLayout == AHLayoutFlow || layout.typeOfLayout == AHLayoutMasonry) return CGRectZero;
+    BOOL horizontal = layout.typeOfLayout == AHLayoutHorizontal;
+    const AHLayoutOldFrameDelta *deltas = [oldFrameDeltas bytes];
+    NSUInteger count = [oldFrameDeltas length] / sizeof(AHLayoutOldFrameDelta);
+    // The first resized object at or after index
+    NSUInteger lo = 0, hi = count;
+    while (lo < hi) {
+        NSUInteger mid = lo + (hi - lo) / 2;
+        if (deltas[mid].index < index) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    CGFloat deltaBefore = lo < count ? deltas[lo].deltaBefore : oldFrameTotalDelta;
+    CGSize deltaAt = lo < count && deltas[lo].index == index ? deltas[lo].deltaAt : CGSizeZero;
+    CGRect frame = [layout rectForViewAtIndex:index];
+    if (CGRectEqualToRect(frame, CGRectZero)) return CGRectZero;
+    frame.size.width -= deltaAt.width;
+    frame.size.height -= deltaAt.height;
+    if (horizontal) {
+        frame.origin.x -= deltaBefore;
+    } else {
+        // Vertical layouts stack bottom-up, so everything at or above the
+        // object moves with the change in content height
+        frame.origin.y += deltaBefore + deltaAt.height - oldFrameTotalDelta;
+    }
+    return frame;
+}
+
+// Sums the resizes of the change list by object once, so finding an old frame
+// is a binary search rather than a pass over every change for every view
+-(void) recordOldFrameDeltas {
+    oldFrameDeltas = nil;
+    oldFrameTotalDelta = 0;
+    NSUInteger count = [changeList count];
+    if (count == 0) return;
+    BOOL horizontal = layout.typeOfLayout == AHLayoutHorizontal;
+    NSMutableData *data = [NSMutableData dataWithLength:count * sizeof(AHLayoutOldFrameDelta)];
+    AHLayoutOldFrameDelta *deltas = [data mutableBytes];
+    NSUInteger i = 0;
+    for (AHLayoutObject *object in changeList) {
+        if (!object.markedForUpdate) return;
+        deltas[i].index = object.index;
+        deltas[i].deltaAt = object.sizeDelta;
+        i++;
+    }
+    qsort(deltas, count, sizeof(AHLayoutOldFrameDelta), AHCompareOldFrameDeltas);
+    // One entry per object, each with the running delta of the ones before it
+    NSUInteger merged = 0;
+    CGFloat before = 0;
+    for (i = 0; i < count; i++) {
+        CGSize delta = deltas[i].deltaAt;
+        if (merged > 0 && deltas[merged - 1].index == deltas[i].index) {
+            deltas[merged - 1].deltaAt.width += delta.width;
+            deltas[merged - 1].deltaAt.height += delta.height;
+        } else {
+            deltas[merged].index = deltas[i].index;
+            deltas[merged].deltaAt = delta;
+            deltas[merged].deltaBefore = before;
+            merged++;
         }
+        before += horizontal ? delta.width : delta.height;
     }
+    [data setLength:merged * sizeof(AHLayoutOldFrameDelta)];
+    oldFrameDeltas = data;
+    oldFrameTotalDelta = before;
 }
 
 
 // Update the frames of the visible subviews
 -(void) moveViews {
     __weak AHLayoutTransaction *weakSelf = self;
-    [layout.objectViewsMap enumerateKeysAndObjectsUsingBlock:^(NSString* key, TUIView *v, BOOL *stop) {
-        NSInteger index = [key integerValue];
-        if (index >= weakSelf.layout.objects.count) {
+    AHLayoutOffsetIndex *offsetIndex = layout.offsetIndex;
+    NSInteger numberOfObjects = layout.numberOfViews;
+    AHLayoutTransactionStatistics *statistics = layout.runningStatistics;
+    [layout.objectViewsMap enumerateViewsUsingBlock:^(NSInteger index, TUIView *v, BOOL *stop) {
+        if (index >= numberOfObjects) {
             return;
         }
-        AHLayoutObject *object = [weakSelf.layout.objects objectAtIndex:index];
-
-        if (object.animation) {
-            [v.layer addAnimation:object.animation forKey:kAHLayoutAnimation];
-            object.animation = nil;
-        }
+        unsigned char flags = AHLayoutOffsetIndexGetFlags(offsetIndex, index);
 
         if (self.phase == AHLayoutTransactionPhasePrelayout) {
-            if (!CGRectIsNull(object.oldFrame)  && !CGRectEqualToRect(CGRectZero, object.oldFrame) && !CGRectEqualToRect(v.frame, object.oldFrame)) {
-                v.frame = object.oldFrame;
+            // Views taken over mid-animation are already where they show
+            CGRect oldFrame = weakSelf.retargeting ? CGRectZero : [weakSelf oldFrameForIndex:index];
+            if (!CGRectEqualToRect(CGRectZero, oldFrame) && !CGRectEqualToRect(v.frame, oldFrame)) {
+                v.frame = oldFrame;
+                if (statistics) statistics->viewsLaidOut++;
+            }
+        } else {
+            CGRect frame = [weakSelf.layout rectForViewAtIndex:index];
+            if (!CGRectEqualToRect(v.frame, frame)) {
+                v.frame = frame;
+                if (statistics) statistics->viewsLaidOut++;
             }
-        } else if (!CGRectEqualToRect(v.frame, object.calculatedFrame))
-        {
-            v.frame = object.calculatedFrame;
         }
 
         if (self.phase == AHLayoutTransactionPhasePrelayout) {
-            if (object.markedForInsertion) {
+            if (flags & AHLayoutObjectFlagInserted) {
                 // send new views to back so other views can animate over it
                 [weakSelf.layout sendSubviewToBack:v];
             }
-        } else if (object.markedForInsertion) {
+        } else if (flags & AHLayoutObjectFlagInserted) {
             [weakSelf.layout bringSubviewToFront:v];
-            object.markedForInsertion = NO;
+            AHLayoutOffsetIndexSetFlags(offsetIndex, index, flags & ~AHLayoutObjectFlagInserted);
         }
 
         [v layoutSubviews];
     }];
     
+    if (self.phase != AHLayoutTransactionPhasePrelayout) {
+        [layout layoutHeadersInRect:nextVisibleRect objectRange:[self objectRangeInRect:nextVisibleRect]];
+    }
 }
 
-// Remove views marked for removal or no longer on screen
+// Recycle the views no longer on screen or in the overscan, right away so they can be
+// reused by the next layout pass
 -(void) cleanup {
-    __weak AHLayout *weakLayout = self.layout;
-    dispatch_async(dispatch_get_main_queue(), ^{
-        NSMutableArray *indexesToRemove = [[NSMutableArray alloc] init];
-        [weakLayout.objectViewsMap enumerateKeysAndObjectsUsingBlock:^(NSString* key, TUIView *v, BOOL *stop) {
-            // check if this view is still on screen
-            if (!CGRectIntersectsRect(nextVisibleRect, v.frame)) {
-                [indexesToRemove addObject:key];
-            }
-        }];
-        
-        for (NSString* index in indexesToRemove) {
-            TUIView *v = [weakLayout.objectViewsMap objectForKey:index];
-            [weakLayout enqueueReusableView:v];
-            [v removeFromSuperview];
-            [weakLayout.objectViewsMap removeObjectForKey:index];
+    AHLayout *l = self.layout;
+    [l.objectViewsMap removeViewsOutsideRange:[self objectRangeInRect:nextBufferedRect] usingBlock:^(NSInteger index, TUIView *v) {
+        [l enqueueReusableView:v];
+        [v removeFromSuperview];
+    }];
+    if (l.typeOfLayout != AHLayoutMasonry) return;
+    // Masonry runs hold items off the rect too
+    NSMutableIndexSet *offscreen = [NSMutableIndexSet indexSet];
+    [l.objectViewsMap enumerateViewsUsingBlock:^(NSInteger index, TUIView *v, BOOL *stop) {
+        if (!CGRectIntersectsRect([l rectForViewAtIndex:index], nextBufferedRect)) [offscreen addIndex:index];
+    }];
+    [offscreen enumerateIndexesUsingBlock:^(NSUInteger index, BOOL *stop) {
+        TUIView *v = [l.objectViewsMap viewForIndex:index];
+        [l.objectViewsMap removeViewForIndex:index];
+        [l enqueueReusableView:v];
+        [v removeFromSuperview];
+    }];
+}
+
+// The indexes of the items crossing rect in a masonry layout, column by column
+-(NSArray*) masonryIndexesInRect:(CGRect) rect {
+    AHLayoutItemFrame frame = AHFrameFromRect(rect);
+    size_t count = AHLayoutCoreCopyItemsInRect(layout.core, frame, NULL, 0);
+    NSMutableData *positions = [NSMutableData dataWithLength:count * sizeof(size_t)];
+    count = AHLayoutCoreCopyItemsInRect(layout.core, frame, [positions mutableBytes], count);
+    const size_t *p = [positions bytes];
+    NSMutableArray *indexes = [NSMutableArray arrayWithCapacity:count];
+    for (size_t i = 0; i < count; i++) [indexes addObject:@(p[i])];
+    return indexes;
+}
+
+// The indexes of the items crossing rect, only those actually in it for a
+// masonry layout rather than the whole run its columns span
+-(NSIndexSet*) objectIndexesInRect:(CGRect) rect {
+    if (layout.typeOfLayout != AHLayoutMasonry) {
+        return [NSIndexSet indexSetWithIndexesInRange:[self objectRangeInRect:rect]];
+    }
+    AHLayoutItemFrame frame = AHFrameFromRect(rect);
+    size_t count = AHLayoutCoreCopyItemsInRect(layout.core, frame, NULL, 0);
+    NSMutableData *positions = [NSMutableData dataWithLength:count * sizeof(size_t)];
+    count = AHLayoutCoreCopyItemsInRect(layout.core, frame, [positions mutableBytes], count);
+    const size_t *p = [positions bytes];
+    NSMutableIndexSet *indexes = [NSMutableIndexSet indexSet];
+    for (size_t i = 0; i < count; i++) [indexes addIndex:p[i]];
+    return indexes;
+}
+
+// The change list as AHLayoutEdits, which AHLayoutEditsPositionAfter rebases
+// indexes through. A moved object is picked up again at the insertion of its move.
+-(NSData*) changeListEdits {
+    NSMutableData *data = [NSMutableData dataWithLength:[changeList count] * sizeof(AHLayoutEdit)];
+    AHLayoutEdit *edits = [data mutableBytes];
+    [changeList enumerateObjectsUsingBlock:^(AHLayoutObject *object, NSUInteger i, BOOL *stop) {
+        AHLayoutEdit edit = {AHLayoutEditUpdate, object.index, 0, object.length};
+        if (object.markedForRemoval) {
+            edit.kind = AHLayoutEditRemove;
+            object.editIndex = i;
+        } else if (object.markedForInsertion) {
+            edit.kind = AHLayoutEditInsert;
+            // The removal comes first in the list, so its position is already noted
+            if (object.movedFrom) edit.moveSource = object.movedFrom.editIndex + 1;
         }
-    });
+        edits[i] = edit;
+    }];
+    return data;
 }
 
-// Shift the index of objects to views on the screen by a positive or negative amount
--(void) moveObjectsAfterPoint:(CGPoint) point byIndexAmount:(NSInteger) indexAmount  {
-    if ([layout.objectViewsMap count]) {
-        NSMutableDictionary *newObjectViewsMap = [[NSMutableDictionary alloc] init];
-        [layout.objectViewsMap enumerateKeysAndObjectsUsingBlock:^(NSString* key, TUIView *v, BOOL *stop) {
-            BOOL afterPoint = NO;
-            BOOL onPoint = NO;
-            if (self.layout.typeOfLayout == AHLayoutHorizontal) {
-                afterPoint = v.frame.origin.x > point.x;
-                onPoint = v.frame.origin.x == point.x;
-            } else {
-                afterPoint = v.frame.origin.y < point.y;
-                onPoint = v.frame.origin.y == point.y;
-            }
-            if (afterPoint ) {
-                NSInteger index = [key integerValue] + indexAmount;
-                NSString *newIndexKey = [NSString stringWithFormat:@"%ld", index];
-                [newObjectViewsMap setValue:v forKey:newIndexKey];
-                [v setTag:index];
-                [v setNeedsDisplay];
-            } else if (!onPoint || indexAmount == 1) {
-                [newObjectViewsMap setValue:v forKey:key];
-            }
+// Takes on a transaction queued after this one, neither having started. Its
+// changes are against the indexes ours leave, so they simply follow ours and
+// the two lay out and animate as one.
+-(void) mergeTransaction:(AHLayoutTransaction*) transaction {
+    if (transaction.scrollToObjectIndex >= 0) {
+        scrollToObjectIndex = transaction.scrollToObjectIndex;
+    } else if (scrollToObjectIndex >= 0) {
+        // Follow our target through the later changes
+        size_t index = AHLayoutEditsPositionAfter([[transaction changeListEdits] bytes], [transaction.changeList count], scrollToObjectIndex);
+        scrollToObjectIndex = index == AHLayoutNotFound ? -1 : index;
+    }
+    [self.changeList addObjectsFromArray:transaction.changeList];
+    if (transaction.keepsAnchor) self.keepsAnchor = YES;
+    for (AHLayoutHandler block in transaction->completionBlocks) {
+        [self addCompletionBlock:block];
+    }
+    AHLayoutHandler firstBlock = animationBlock;
+    AHLayoutHandler secondBlock = transaction.animationBlock;
+    if (firstBlock && secondBlock) {
+        self.animationBlock = ^(AHLayout *l) {
+            firstBlock(l);
+            secondBlock(l);
+        };
+    } else if (secondBlock) {
+        self.animationBlock = secondBlock;
+    }
+    if (transaction.viewAnimationBlock) self.viewAnimationBlock = transaction.viewAnimationBlock;
+    animationDuration = MAX(animationDuration, transaction.animationDuration);
+    self.maintainContentOffset = self.maintainContentOffset || transaction.maintainContentOffset;
+    // The data source may be mid-update for either
+    self.shouldNotCallDelegate = self.shouldNotCallDelegate || transaction.shouldNotCallDelegate;
+}
+
+// Stops the interrupted animation where it is on screen: the views and the
+// scroll position take on their presentation values, so the animation to
+// the new layout starts from there instead of snapping
+-(void) adoptPresentationFrames {
+    [TUIView setAnimationsEnabled:NO block:^{
+        CALayer *scrollLayer = [layout.layer presentationLayer];
+        if (scrollLayer) {
+            CGPoint origin = scrollLayer.bounds.origin;
+            layout.contentOffset = CGPointMake(-origin.x, -origin.y);
+        }
+        [layout.layer removeAnimationForKey:@"bounds"];
+        [layout.objectViewsMap enumerateViewsUsingBlock:^(NSInteger index, TUIView *v, BOOL *stop) {
+            CALayer *presentation = [v.layer presentationLayer];
+            if (presentation) v.frame = presentation.frame;
+            [v.layer removeAnimationForKey:@"position"];
+            [v.layer removeAnimationForKey:@"bounds"];
         }];
-        // Replace map
-        [layout.objectViewsMap setDictionary:newObjectViewsMap];
+    }];
+}
+
+// How many views the change list adds, until it has been applied
+-(NSInteger) pendingCountChange {
+    if (processedChangeList) return 0;
+    NSInteger change = 0;
+    for (AHLayoutObject *object in changeList) {
+        NSInteger length = object.length;
+        change += object.markedForInsertion ? length : (object.markedForRemoval ? -length : 0);
     }
+    return change;
 }
 
 #pragma mark - Calculations
 
 -(CGPoint) calculateNextContentOffset {
+    [self measureObjectsIfNeeded];
     [self calculateContentSize];
-    [self calculateObjectOffsets];
     CGPoint p = [self contentOffset:layout.contentOffset afterChangeInContentSizeFrom:layout.contentSize toSize:contentSize];
     return [self fixContentOffset:p forSize:contentSize inBounds:layout.bounds];
 }
@@ -567,184 +1314,91 @@ typedef enum {
         nextVisibleRect = layout.visibleRect;
     } else {
         // Calculate the new visble rect
-        nextVisibleRect = layout.bounds;
-        CGPoint offset = contentOffset;
-        offset.x = -offset.x;
-        offset.y = -offset.y;
-        nextVisibleRect.origin = offset;
+        nextVisibleRect = AHRectFromFrame(AHLayoutVisibleRectForContentOffset(AHPointFromCGPoint(contentOffset), AHSizeFromCGSize(layout.bounds.size)));
     }
     nextVisibleRect = CGRectIntegral(nextVisibleRect);
+    nextBufferedRect = [layout overscanRectForVisibleRect:nextVisibleRect];
 }
 
--(void) calculateContentSize {
-    __block CGFloat calculatedHeight = 0;
-    __block CGFloat calculatedWidth = 0;
-    __block AHLayoutType layoutType = layout.typeOfLayout;
-    __weak AHLayout *weakLayout = self.layout;
-    NSInteger idx = 0;
-    if (CGSizeEqualToSize(CGSizeZero, self.contentSize)) {
-        for (AHLayoutObject *object in layout.objects) {
-            object.size = [layout.dataSource layout:layout sizeOfViewAtIndex:object.index];
-            if (layoutType == AHLayoutVertical) {
-                calculatedHeight += object.size.height + weakLayout.spaceBetweenViews;
+// Ask the data source for the size of every object, only needed after a reload
+// or when the bounds change, edits keep the offset index up to date on their own
+-(void) measureObjectsIfNeeded {
+    if (self.shouldNotCallDelegate) return;
+    if ([layout needsMeasuringForBounds:layout.bounds]) {
+        [layout measureObjects];
+    }
+}
+
+// With estimated sizes only the objects on or near the screen are measured.
+// Their real sizes move everything around them, so the first visible object is
+// kept where it is on screen and the content size and offset follow it.
+// Measuring can change what is visible, so repeat until nothing new comes in.
+-(void) measureVisibleObjects {
+    if (!layout.estimatingSizes || self.shouldNotCallDelegate) return;
+    BOOL horizontal = layout.typeOfLayout == AHLayoutHorizontal;
+    for (NSInteger pass = 0; pass < kAHLayoutMaxMeasuringPasses; pass++) {
+        // Measure half a screen either side as well so scrolling doesn't jump,
+        // and the overscan so its views come in at their real size
+        CGRect nearRect = horizontal ? CGRectInset(nextVisibleRect, -nextVisibleRect.size.width / 2, 0) : CGRectInset(nextVisibleRect, 0, -nextVisibleRect.size.height / 2);
+        nearRect = CGRectUnion(nearRect, nextBufferedRect);
+        NSUInteger visibleIndex = [[self objectIndexesInRect:nextVisibleRect] firstIndex];
+        CGRect anchorFrame = visibleIndex != NSNotFound ? [layout rectForViewAtIndex:visibleIndex] : CGRectZero;
+        __block BOOL changed = NO;
+        [[self objectIndexesInRect:nearRect] enumerateRangesUsingBlock:^(NSRange range, BOOL *stop) {
+            changed |= [layout measureObjectsInRange:range];
+        }];
+        if (!changed) return;
+        
+        [self calculateContentSize];
+        CGPoint offset = phase == AHLayoutTransactionPhasePrelayout ? contentOffset : layout.contentOffset;
+        if (visibleIndex != NSNotFound) {
+            CGRect newAnchorFrame = [layout rectForViewAtIndex:visibleIndex];
+            if (horizontal) {
+                offset.x -= newAnchorFrame.origin.x - anchorFrame.origin.x;
             } else {
-                calculatedWidth += object.size.width + weakLayout.spaceBetweenViews;
+                offset.y -= newAnchorFrame.origin.y - anchorFrame.origin.y;
             }
-            idx +=1;
-        }
-    } else {
-        calculatedHeight = contentSize.height;
-        calculatedWidth = contentSize.width;
-    }
-    // final contentSize is modified by the amount of insertions, removals, and resizs
-    for (AHLayoutObject *object in changeList) {
-        if (object.markedForUpdate) {
-            AHLayoutObject *oldObject = [layout.objects objectAtIndex:object.index];
-            calculatedHeight += (object.size.height - oldObject.size.height);
-            calculatedWidth += (object.size.width - oldObject.size.width);
-        }
-        if (object.markedForInsertion) {
-            calculatedHeight += object.size.height;
-            calculatedWidth += object.size.width;
         }
-        if (object.markedForRemoval) {
-            calculatedHeight -= object.size.height;
-            calculatedWidth -= object.size.width;
+        offset = [self fixContentOffset:offset forSize:contentSize inBounds:layout.bounds];
+        if (phase == AHLayoutTransactionPhasePrelayout) {
+            contentOffset = offset;
+        } else {
+            layout.contentSize = contentSize;
+            layout.contentOffset = offset;
         }
-    }
-    if (layoutType == AHLayoutHorizontal) {
-        calculatedHeight = weakLayout.bounds.size.height;
-    } else {
-        calculatedWidth = weakLayout.bounds.size.width;
-    }
-    self.contentSize = CGSizeMake(calculatedWidth, calculatedHeight);
-}
-
-- (void) calculateObjectOffsets {
-    (layout.typeOfLayout == AHLayoutVertical) ? [self calculateObjectOffsetsVertical] : [self calculateObjectOffsetsHorizontal];
-}
-
-- (void) calculateObjectOffsetsVertical {
-    CGFloat offset = self.contentSize.height;
-    for (AHLayoutObject *object in layout.objects) {
-        offset -= object.size.height + layout.spaceBetweenViews;
-        object.y = offset + layout.spaceBetweenViews;
+        [self calculateNextVisibleRect];
     }
 }
 
-- (void) calculateObjectOffsetsHorizontal {
-    CGFloat i = 0;
-    CGFloat offset = 0;
-    for (AHLayoutObject *object in layout.objects) {
-        if (i==0) {
-            offset += layout.spaceBetweenViews;
-        }
-        object.x = offset;
-        i += 1;
-        offset += object.size.width + layout.spaceBetweenViews;
-    }
+// The offset index keeps the summed extent of every object, so this is O(1)
+-(void) calculateContentSize {
+    self.contentSize = AHCGSizeFromSize(AHLayoutCoreContentSize(layout.core));
 }
 
 
 #pragma mark - Geometry
 
 -(CGPoint) contentOffset:(CGPoint) theContentOffset afterChangeInContentSizeFrom:(CGSize) oldContentSize toSize:(CGSize) newContentSize {
-    CGPoint c = theContentOffset;
-    if (self.layout.typeOfLayout == AHLayoutHorizontal  && oldContentSize.width > 0) {
-        c.x = oldContentSize.width + c.x - newContentSize.width;
-        c.x = roundf(c.x);
-    }
-    if (self.layout.typeOfLayout == AHLayoutVertical && oldContentSize.height > 0) {
-        c.y += oldContentSize.height + c.y - newContentSize.height;
-        c.y = roundf(c.y);
-    }
-    return c;
+    return AHCGPointFromPoint(AHLayoutContentOffsetAfterResize(AHPointFromCGPoint(theContentOffset), AHSizeFromCGSize(oldContentSize), AHSizeFromCGSize(newContentSize), layout.typeOfLayout == AHLayoutHorizontal));
 }
 
 - (CGPoint)modifyContentOffset:(CGPoint)c forRect:(CGRect)rect inVisibleRect:(CGRect) visible horizontal:(BOOL)horizontal
 {
-    // What about horizontal scrolling peeps
-    if (horizontal) {
-        if (rect.origin.x + rect.size.width > visible.origin.x + visible.size.width) {
-            //Scroll right, have rect be flush with right of visible view
-            c = CGPointMake(-rect.origin.x + visible.size.width - rect.size.width, 0);
-        } else if (rect.origin.x  < visible.origin.x) {
-            // Scroll left, rect flush with left of leftmost visible view
-            c = CGPointMake(-rect.origin.x, 0);
-        }
-    } else if (rect.origin.y < visible.origin.y) {
-		// scroll down, have rect be flush with bottom of visible view
-		c= CGPointMake(0, -rect.origin.y);
-	} else if (rect.origin.y + rect.size.height > visible.origin.y + visible.size.height) {
-		// scroll up, rect to be flush with top of view
-		c = CGPointMake(0, -rect.origin.y + visible.size.height - rect.size.height);
-	}
-    return c;
+    return AHCGPointFromPoint(AHLayoutContentOffsetShowingRect(AHPointFromCGPoint(c), AHFrameFromRect(rect), AHFrameFromRect(visible), horizontal));
 }
 
-
-
-- (NSMutableArray *)objectIndexesInRect:(CGRect)rect
+// Objects are sorted by offset, so the ones in rect are a contiguous run
+// found by binary search through the offset index in O(log n)
+- (NSRange)objectRangeInRect:(CGRect)rect
 {
-	NSMutableArray *foundObjects = [NSMutableArray arrayWithCapacity:5];
-	for(AHLayoutObject *object in layout.objects) {
-        if(CGRectIntersectsRect(object.calculatedFrame, rect)) {
-            [foundObjects addObject:[NSString stringWithFormat:@"%ld", [layout.objects indexOfObject:object]]];
-        }
-	}
-	return foundObjects;
-}
-
--(NSString*) indexKeyForObject:(AHLayoutObject*) object {
-    return [NSString stringWithFormat:@"%ld", [layout.objects indexOfObject:object]];
+    size_t first, count;
+    AHLayoutCoreItemsInRect(layout.core, AHFrameFromRect(rect), &first, &count);
+	return NSMakeRange(first, count);
 }
 
-
-
 - (CGPoint) fixContentOffset:(CGPoint)offset forSize:(CGSize) size inBounds:(CGRect) b
 {
-	CGSize s = size;
-	
-	CGFloat mx = offset.x + s.width;
-	if (s.width > b.size.width) {
-		if (mx < b.size.width) {
-			offset.x = b.size.width - s.width;
-		}
-		if (offset.x > 0.0) {
-			offset.x = 0.0;
-		}
-	} else {
-		if (mx > b.size.width) {
-			offset.x = b.size.width - s.width;
-		}
-		if (offset.x < 0.0) {
-			offset.x = 0.0;
-		}
-	}
-	
-	CGFloat my = offset.y + s.height;
-	if (s.height > b.size.height) { // content bigger than bounds
-		if (my < b.size.height) {
-			offset.y = b.size.height - s.height;
-		}
-		if (offset.y > 0.0) {
-			offset.y = 0.0;
-		}
-	} else { // content smaller than bounds
-		if (0) { // let it move around in bounds
-			if (my > b.size.height) {
-				offset.y = b.size.height - s.height;
-			}
-			if (offset.y < 0.0) {
-				offset.y = 0.0;
-			}
-		}
-		if (1) { // pin to top
-			offset.y = b.size.height - s.height;
-		}
-	}
-	
-	return offset;
+    return AHCGPointFromPoint(AHLayoutFixContentOffset(AHPointFromCGPoint(offset), AHSizeFromCGSize(size), AHSizeFromCGSize(b.size)));
 }
 
 @end
@@ -753,27 +1407,62 @@ typedef enum {
 @implementation AHLayout {
     NSMutableArray *updateStack;
     NSMutableArray *executionQueue;
-    NSMutableArray *reusableViews;
+    NSMutableDictionary *reusePools;
+    dispatch_source_t memoryPressureSource;
     BOOL animating;
     AHLayoutTransaction *defaultTransaction;
+    AHLayoutCore *core;
+    // The core's items, kept at hand for the many places that need them
+    AHLayoutOffsetIndex *offsetIndex;
+    AHLayoutSectionIndex *sectionIndex;
+    NSMutableDictionary *headerViews;
+    CGSize measuredSize;
+    BOOL estimatingSizes;
+    NSMutableIndexSet *prefetchedIndexes;
+    CGFloat lastScrollPosition;
+    CFAbsoluteTime lastScrollTime;
+    NSInteger scrollDirection;
+    // Points per second along the scrolling axis
+    CGFloat scrollSpeed;
+    // Work done while no transaction is counting, such as the start of
+    // reloadData, counted towards the next one to run
+    AHLayoutTransactionStatistics pendingStatistics;
+    AHLayoutSizeCache *sizeCache;
 }
 
 @synthesize viewClass;
 @synthesize executingTransaction;
 @synthesize objectViewsMap;
-@synthesize objects;
 @synthesize dataSource;
+@synthesize prefetchDataSource;
 @synthesize spaceBetweenViews;
 @synthesize reloadedDate;
 @synthesize typeOfLayout;
 @synthesize reloadHandler;
 @synthesize didFirstLayout;
+@synthesize offsetIndex;
+@synthesize needsMeasuring;
+@synthesize estimatedViewSize;
+@synthesize estimatingSizes;
+@synthesize stickyHeaders;
+@synthesize overscan;
+@synthesize collectsTransactionStatistics;
+@synthesize lastTransactionStatistics;
+@synthesize transactionStatisticsHandler;
+@synthesize countingTransaction;
+@synthesize sizeCachePath;
+@synthesize snapshotIdentifiers;
 
 - (id)initWithFrame:(CGRect)frame {
     if((self = [super initWithFrame:frame])) {
         spaceBetweenViews = 0;
-        self.objects = [NSMutableArray array];
-        objectViewsMap = [NSMutableDictionary dictionary];
+        core = AHLayoutCoreCreate();
+        offsetIndex = AHLayoutCoreItems(core);
+        sectionIndex = AHLayoutSectionIndexCreate();
+        headerViews = [NSMutableDictionary dictionary];
+        prefetchedIndexes = [NSMutableIndexSet indexSet];
+        stickyHeaders = YES;
+        objectViewsMap = [[AHLayoutViewMap alloc] init];
         updateStack = [NSMutableArray array];
         executionQueue = [NSMutableArray array];
         
@@ -782,38 +1471,73 @@ typedef enum {
         
         self.typeOfLayout = AHLayoutVertical;
         self.viewClass = [TUIView class];
+        reusePools = [NSMutableDictionary dictionary];
         
+#ifdef DISPATCH_SOURCE_TYPE_MEMORYPRESSURE
+        // Memory pressure sources are only there from 10.9 on
+        if (DISPATCH_SOURCE_TYPE_MEMORYPRESSURE) {
+            __weak AHLayout *weakSelf = self;
+            dispatch_source_t source = dispatch_source_create(DISPATCH_SOURCE_TYPE_MEMORYPRESSURE, 0, DISPATCH_MEMORYPRESSURE_WARN | DISPATCH_MEMORYPRESSURE_CRITICAL, dispatch_get_main_queue());
+            dispatch_source_set_event_handler(source, ^{
+                [weakSelf handleMemoryPressure:dispatch_source_get_data(source)];
+            });
+            dispatch_resume(source);
+            memoryPressureSource = source;
+        }
+#endif
     }
     return self;
 }
 
-#pragma mark - Execute Transactions
+- (void)dealloc {
+    // Cancelling releases the handler, which holds on to the source
+    if (memoryPressureSource) dispatch_source_cancel(memoryPressureSource);
+    AHLayoutCoreFree(core);
+    AHLayoutSectionIndexFree(sectionIndex);
+    AHLayoutSizeCacheClose(sizeCache);
+}
+
+#pragma mark - Execute Transactions
 
 - (void) layoutSubviews{
     [super layoutSubviews];
-    // don't interfere with active animating transactions
-    if ( !self.executingTransaction || (self.executingTransaction && (self.executingTransaction.phase != AHLayoutTransactionPhaseAnimating))) {
+    [self updateScrollSpeed];
+    // don't interfere with active animating transactions, unless updates are
+    // waiting, they take over from wherever the animation has got to
+    if ( !self.executingTransaction || (self.executingTransaction.phase != AHLayoutTransactionPhaseAnimating) || self.waitingTransaction) {
         [self executeNextLayoutTransaction];
     }
+    [self updatePrefetching];
 }
 
 -(void) executeNextLayoutTransaction {
     
-    // check for any updates
-    AHLayoutTransaction *nextTransaction = [executionQueue lastObject];
+    // An animated transaction finishes its prelayout before the next one starts,
+    // until then the layout passes are its own
+    AHLayoutTransaction *current = self.executingTransaction;
+    AHLayoutTransaction *nextTransaction = current;
+    BOOL inProgress = current && current.phase == AHLayoutTransactionPhasePrelayout;
+    // check for any updates, endUpdates merges them so at most one is waiting
+    AHLayoutTransaction *waiting = inProgress ? nil : self.waitingTransaction;
+    if (waiting) nextTransaction = waiting;
+    // On first layout, we use the default transaction, after that
     // continue to execute the last transaction if no updates pending
-    if (!nextTransaction) nextTransaction = self.executingTransaction;
-    // On first layout, we use the default transaction
     if (!nextTransaction) nextTransaction = defaultTransaction;
     self.executingTransaction = nextTransaction;
     
-    if ([executionQueue count] >= 1 && nextTransaction.phase == AHLayoutTransactionPhaseNormal) {
+    if (waiting) {
+        if (current.phase == AHLayoutTransactionPhaseAnimating) {
+            // Retarget the running animation rather than wait for it
+            current.retargeted = YES;
+            waiting.retargeting = YES;
+            // Its objects are still flagged as inserted, the new changes carry them along
+            [waiting.insertedIndexes addIndexes:current.insertedIndexes];
+        }
         __weak AHLayout* weakSelf = self;
         __weak NSMutableArray *weakExecutionQueue = executionQueue;
+        __weak AHLayoutTransaction *weakTransaction = nextTransaction;
         [nextTransaction addCompletionBlock: ^(AHLayout* l){
-            if (weakSelf.executingTransaction.phase == AHLayoutTransactionPhaseNormal) {
-                [weakExecutionQueue removeLastObject];
-            }
+            [weakExecutionQueue removeObjectIdenticalTo:weakTransaction];
             [weakSelf performSelector:@selector(setNeedsLayout) withObject:nil afterDelay:0];
         }];
     }
@@ -824,6 +1548,23 @@ typedef enum {
     [super setNeedsLayout];
 }
 
+// The queued transaction yet to start, if any
+-(AHLayoutTransaction*) waitingTransaction {
+    for (AHLayoutTransaction *transaction in executionQueue) {
+        if (transaction != self.executingTransaction && transaction.phase == AHLayoutTransactionPhaseNormal && !transaction.retargeted) return transaction;
+    }
+    return nil;
+}
+
+// Queued transactions only reach the offset index when they run
+-(NSInteger) numberOfViewsAfterQueuedUpdates {
+    NSInteger count = self.numberOfViews;
+    for (AHLayoutTransaction *transaction in executionQueue) {
+        count += [transaction pendingCountChange];
+    }
+    return count;
+}
+
 -(void) beginUpdates {
     AHLayoutTransaction *transaction = [[AHLayoutTransaction alloc] init];
     transaction.shouldAnimate = YES;
@@ -841,8 +1582,17 @@ typedef enum {
 -(void) endUpdates {
     // Send this transaction be executed
     if ([updateStack count] > 0) {
-        [executionQueue addObject:[updateStack lastObject]];
+        AHLayoutTransaction *transaction = [updateStack lastObject];
+        AHLayoutTransaction *waiting = self.waitingTransaction;
+        if (waiting) {
+            // Bursts of updates share one layout pass and one animation
+            [waiting mergeTransaction:transaction];
+        } else {
+            [executionQueue addObject:transaction];
+        }
         [updateStack removeLastObject];
+        // Prefetched indexes may no longer point at the same objects
+        [self cancelPrefetching];
         [self setNeedsLayout];
     }
 }
@@ -858,35 +1608,32 @@ typedef enum {
         // NSAssert(false, @"Calling reloadData with empty bounds");
     }
     
+    // Taken before anything changes, restored once the new sizes are in
+    AHLayoutAnchor previousAnchor = self.anchor;
     self.contentSize = CGSizeMake(0, 0);
+    [self cancelPrefetching];
+    snapshotIdentifiers = nil;
     
     reloadedDate = [NSDate date];
-    NSString *firstObjectIndex = nil;
-    if (objectViewsMap.allKeys && objectViewsMap.allKeys.count > 0) {
-        NSArray *sortedKeys = [[objectViewsMap allKeys] sortedArrayUsingSelector:@selector(compare:)];
-        if (sortedKeys && sortedKeys.count> 0) {
-            firstObjectIndex = [sortedKeys objectAtIndex:0];
-        }
-    }
-    [objectViewsMap enumerateKeysAndObjectsUsingBlock:^(NSString *indexKey, TUIView *view, BOOL *stop) {
+    [objectViewsMap enumerateViewsUsingBlock:^(NSInteger index, TUIView *view, BOOL *stop) {
         [self enqueueReusableView:view];
         [view removeFromSuperview];
     }];
     
-    objectViewsMap = [NSMutableDictionary dictionary];
+    [objectViewsMap removeAllViews];
+    for (TUIView *header in [headerViews allValues]) {
+        [header removeFromSuperview];
+    }
+    [headerViews removeAllObjects];
     NSUInteger numberOfObjects = [dataSource numberOfViewsInLayout:self];
+    if (collectsTransactionStatistics) self.runningStatistics->dataSourceCalls++;
+    // Zero sized until measured
+    AHLayoutOffsetIndexReset(offsetIndex, numberOfObjects, NULL, NULL);
+    self.needsMeasuring = YES;
     if (numberOfObjects == 0) {
-        objects = [NSMutableArray array];
         [self setNeedsLayout];
         return;
     }
-    self.objects = [NSMutableArray arrayWithCapacity:numberOfObjects];
-    for (NSUInteger i =0; i < numberOfObjects; i++) {
-        AHLayoutObject *object = [[AHLayoutObject alloc] init];
-        [self.objects addObject:object];
-        object.index = i;
-        object.indexString = [NSString stringWithFormat:@"%ld", i];
-    }
     
     if (self.executingTransaction) {
         self.executingTransaction = nil;
@@ -900,10 +1647,8 @@ typedef enum {
     CGPoint contentOffset = [defaultTransaction calculateNextContentOffset];
     
     // Now refine the contentOffset a bit more to make sure we scroll to the right object
-    if (firstObjectIndex && firstObjectIndex.length && firstObjectIndex.integerValue < self.objects.count) {
-        AHLayoutObject *scrollToObject = [self.objects objectAtIndex:[firstObjectIndex integerValue]];
-        contentOffset = [defaultTransaction modifyContentOffset:contentOffset forRect:scrollToObject.calculatedFrame inVisibleRect:self.visibleRect horizontal:(self.typeOfLayout == AHLayoutHorizontal)];
-        contentOffset = [defaultTransaction fixContentOffset:contentOffset forSize:defaultTransaction.contentSize inBounds:self.bounds];
+    if (previousAnchor.index != NSNotFound && previousAnchor.index < (NSUInteger)self.numberOfViews) {
+        contentOffset = [defaultTransaction fixContentOffset:[self contentOffsetForAnchor:previousAnchor] forSize:defaultTransaction.contentSize inBounds:self.bounds];
     }
     self.contentOffset = contentOffset;
     
@@ -916,46 +1661,33 @@ typedef enum {
 
 - (TUIView*) dequeueReusableView
 {
-    TUIView *v = [reusableViews lastObject];
-    if(v) [reusableViews removeLastObject];
-    if (!v) v = [self createView];
-	return v;
+    return [self dequeueReusableViewWithIdentifier:kAHLayoutDefaultReuseIdentifier];
 }
 
 -(TUIView*) viewForIndex:(NSUInteger)index {
-    if (!objectViewsMap || ![objectViewsMap.allKeys count]) return nil;
-    NSString *indexKey = [NSString stringWithFormat:@"%ld", index];
-    return [objectViewsMap objectForKey:indexKey];
+    return [objectViewsMap viewForIndex:index];
 }
 
 -(NSInteger) indexForView:(TUIView*)v {
-    if (!objectViewsMap || ![objectViewsMap.allKeys count]) return -1;
-    NSArray *a = [objectViewsMap allKeysForObject:v];
-    if (a.count > 0) {
-        NSString *indexStr = [a objectAtIndex:0];
-        return [indexStr integerValue];
-    }
-    return -1;
+    NSInteger index = [objectViewsMap indexForView:v];
+    return index == NSNotFound ? -1 : index;
 }
 
-- (AHLayoutObject*) objectAtPoint:(CGPoint) point {
-    for (AHLayoutObject *object in objects) {
-        if (CGRectContainsPoint(object.calculatedFrame, point)) {
-            return object;
-        }
-    }
-    return nil;
+// O(log n) through whichever index places the views
+- (NSUInteger) objectIndexAtPoint:(CGPoint) point {
+    size_t index = AHLayoutCoreItemAtPoint(self.core, AHPointFromCGPoint(point));
+    return index == AHLayoutNotFound ? NSNotFound : index;
 }
 
 - (NSUInteger) indexOfViewAtPoint:(CGPoint)point {
-    return [self objectAtPoint:point].index;
+    return [self objectIndexAtPoint:point];
 }
 
 
 - (TUIView*) viewAtPoint:(CGPoint) point {
-    AHLayoutObject *object = [self objectAtPoint:point];
-    if (object) {
-        return [objectViewsMap objectForKey:object.indexString];
+    NSUInteger index = [self objectIndexAtPoint:point];
+    if (index != NSNotFound) {
+        return [objectViewsMap viewForIndex:index];
     }
     return nil;
 }
@@ -968,8 +1700,39 @@ typedef enum {
 
 
 - (CGRect) rectForViewAtIndex:(NSUInteger) index {
-    AHLayoutObject *object = [objects objectAtIndex:index];
-    return object.calculatedFrame;
+    if (index >= AHLayoutOffsetIndexCount(offsetIndex)) return CGRectZero;
+    return AHRectFromFrame(AHLayoutCoreFrameOfItem(self.core, index));
+}
+
+-(AHLayoutAnchor) anchor {
+    AHLayoutAnchor anchor = {NSNotFound, 0};
+    CGRect visible = self.visibleRect;
+    size_t first, count;
+    if (!AHLayoutCoreItemsInRect(self.core, AHFrameFromRect(visible), &first, &count) || count == 0) return anchor;
+    CGRect r = [self rectForViewAtIndex:first];
+    anchor.index = first;
+    anchor.offset = typeOfLayout == AHLayoutHorizontal ? CGRectGetMinX(r) - CGRectGetMinX(visible) : CGRectGetMaxY(visible) - CGRectGetMaxY(r);
+    return anchor;
+}
+
+-(void) setAnchor:(AHLayoutAnchor) anchor {
+    if (anchor.index == NSNotFound || anchor.index >= (NSUInteger)self.numberOfViews) return;
+    CGPoint offset = [self contentOffsetForAnchor:anchor];
+    self.contentOffset = AHCGPointFromPoint(AHLayoutFixContentOffset(AHPointFromCGPoint(offset), AHSizeFromCGSize(self.contentSize), AHSizeFromCGSize(self.bounds.size)));
+    [self setNeedsLayout];
+}
+
+// The content offset putting the anchor's object where the anchor says, before
+// keeping it inside the content
+-(CGPoint) contentOffsetForAnchor:(AHLayoutAnchor) anchor {
+    CGPoint offset = self.contentOffset;
+    CGRect r = [self rectForViewAtIndex:anchor.index];
+    if (typeOfLayout == AHLayoutHorizontal) {
+        offset.x = -(CGRectGetMinX(r) - anchor.offset);
+    } else {
+        offset.y = -(CGRectGetMaxY(r) + anchor.offset - self.bounds.size.height);
+    }
+    return offset;
 }
 
 - (void)scrollToViewAtIndex:(NSUInteger)index atScrollPosition:(AHLayoutScrollPosition)scrollPosition animated:(BOOL)animated
@@ -1003,20 +1766,19 @@ typedef enum {
 -(TUIView*) replaceViewForObjectAtIndex:(NSUInteger) index withSize:(CGSize) size {
     
     // This view has to already exist
-    if (!objects || ![objects count]) return nil;
-    NSString *indexKey = [NSString stringWithFormat:@"%ld", index];
-    AHLayoutObject *object = [self.objects objectAtIndex:index];
+    if (index >= self.numberOfViews) return nil;
     
     // Make sure the view exists
-    TUIView *v = [objectViewsMap objectForKey:indexKey];
+    TUIView *v = [objectViewsMap viewForIndex:index];
     if (v) {
         // remove the view from our mapping
-        [self.objectViewsMap removeObjectForKey:indexKey];
+        [self.objectViewsMap removeViewForIndex:index];
         // remove it so it won't be reused
-        [reusableViews removeObject:v];
+        [[self reusePoolForIdentifier:objc_getAssociatedObject(v, &AHLayoutReuseIdentifierKey)].views removeObject:v];
         //Add another one in it's place
-        object.size = size;
-        return [self.executingTransaction addSubviewForObject:object atIndex:[NSString stringWithFormat:@"%ld", index]];
+        AHLayoutOffsetIndexSetSize(offsetIndex, index, size.width, size.height);
+        [self objectResizedAtIndex:index];
+        return [self.executingTransaction addSubviewAtIndex:index];
     }
     return nil;
 }
@@ -1030,14 +1792,11 @@ typedef enum {
         [self.updatingTransaction addCompletionBlock:completionBlock];
         self.updatingTransaction.animationBlock = animationBlock;
         self.updatingTransaction.animationDuration = 2.3;
-        AHLayoutObject *oldObject = [self.objects objectAtIndex:index];
         AHLayoutObject *object = [[AHLayoutObject alloc] init];
         NSValue *objectSize = [sizes objectAtIndex:idx];
         object.size = [objectSize sizeValue];
-        object.oldFrame = oldObject.calculatedFrame;
         object.markedForUpdate = YES;
         object.index = index;
-        object.indexString = [NSString stringWithFormat:@"%ld", index];
         [self.updatingTransaction.changeList addObject:object];
     }];
 }
@@ -1048,15 +1807,14 @@ typedef enum {
     self.updatingTransaction.animationBlock = animationBlock;
     self.updatingTransaction.animationDuration = 0.5;
     self.updatingTransaction.scrollToObjectIndex = scrollToObjectIndex;
-    [self.objects enumerateObjectsUsingBlock:^(AHLayoutObject *obj, NSUInteger idx, BOOL *stop) {
+    NSInteger numberOfObjects = self.numberOfViews;
+    for (NSInteger idx = 0; idx < numberOfObjects; idx++) {
         AHLayoutObject *object = [[AHLayoutObject alloc] init];
         object.size = size;
-        object.oldFrame = obj.calculatedFrame;
         object.markedForUpdate = YES;
-        object.index = obj.index;
-        object.indexString = [NSString stringWithFormat:@"%ld", idx];
+        object.index = idx;
         [self.updatingTransaction.changeList addObject:object];
-    }];
+    }
 }
 
 - (void) resizeViewAtIndex:(NSUInteger) index toSize:(CGSize) size animationBlock:(void (^)())animationBlock  completionBlock:(void (^)())completionBlock {
@@ -1064,16 +1822,10 @@ typedef enum {
     self.updatingTransaction.animationBlock = animationBlock;
     self.updatingTransaction.animationDuration = 0.5;
     self.updatingTransaction.scrollToObjectIndex = index;
-    AHLayoutObject *oldObject = [self.objects objectAtIndex:index];
     AHLayoutObject *object = [[AHLayoutObject alloc] init];
     object.size = size;
-    object.oldFrame = oldObject.calculatedFrame;
     object.markedForUpdate = YES;
     object.index = index;
-    object.indexString = [NSString stringWithFormat:@"%ld", index];
-    [self.objects enumerateObjectsUsingBlock:^(AHLayoutObject *obj, NSUInteger idx, BOOL *stop) {
-        obj.oldFrame = obj.calculatedFrame;
-    }];
     [self.updatingTransaction.changeList addObject:object];
 }
 
@@ -1084,14 +1836,9 @@ typedef enum {
 -(void) insertViewAtIndex:(NSUInteger) index  animationBlock:(AHLayoutViewAnimationBlock)animationBlock  completionBlock:(void (^)())completionBlock
 {
     // Check for a valid insertion point
-    NSAssert(index >= 0 && index <= ([self.objects count]), @"AHLayout object out of range");
+    NSAssert(index >= 0 && index <= [self numberOfViewsAfterQueuedUpdates], @"AHLayout object out of range");
     [self beginUpdates];
-    AHLayoutObject *object = [[AHLayoutObject alloc] init];
-    object.size = [dataSource layout:self  sizeOfViewAtIndex:index];
-    object.markedForInsertion = YES;
-    object.index = index;
-    object.indexString = [NSString stringWithFormat:@"%ld", index];
-    [self.updatingTransaction.changeList addObject:object];
+    [self addChangesForInsertions:[NSIndexSet indexSetWithIndex:index] deletions:nil reloads:nil moves:nil];
     self.updatingTransaction.animationDuration = 0.2;
     self.updatingTransaction.scrollToObjectIndex = index;
     self.updatingTransaction.viewAnimationBlock = animationBlock;
@@ -1102,16 +1849,10 @@ typedef enum {
 
 -(void) removeViewsAtIndexes:(NSIndexSet *)indexes animationBlock:(AHLayoutViewAnimationBlock)animationBlock  completionBlock:(void (^)())completionBlock {
     [self beginUpdates];
-    
-    [indexes enumerateIndexesUsingBlock:^(NSUInteger idx, BOOL *stop) {
-        // Valid index
-        NSAssert(idx >= 0 || idx < ([self.objects count]), @"AHLayout object out of range");
-        AHLayoutObject *object = [self.objects objectAtIndex:idx];
-        object.markedForRemoval = YES;
-        self.updatingTransaction.scrollToObjectIndex = object.index;
-        [self.updatingTransaction.changeList addObject:object];
-    }];
-    self.updatingTransaction.contentSize = self.contentSize;
+    [self addChangesForInsertions:nil deletions:indexes reloads:nil moves:nil];
+    if (indexes.count > 0) {
+        self.updatingTransaction.scrollToObjectIndex = indexes.lastIndex;
+    }
     self.updatingTransaction.shouldNotCallDelegate = YES;  //in case the caller deletes the objects from their model before calling this
     self.updatingTransaction.viewAnimationBlock = animationBlock;
     [self.updatingTransaction addCompletionBlock:completionBlock];
@@ -1121,61 +1862,851 @@ typedef enum {
 
 -(void) prependNumOfViews:(NSInteger) numOfObjects animationBlock:(void (^)())animationBlock  completionBlock:(void (^)())completionBlock {
     [self beginUpdates];
-    for (NSInteger i = numOfObjects; i > 0; i--) {
-        AHLayoutObject *object = [[AHLayoutObject alloc] init];
-        object.size = [dataSource layout:self sizeOfViewAtIndex:i];
-        object.markedForInsertion = YES;
-        object.index = i - 1;
-        object.indexString = [NSString stringWithFormat:@"%ld", object.index];
-        [self.updatingTransaction.changeList addObject:object];
-    }
-    self.updatingTransaction.scrollToObjectIndex = [self objectIndexAtTopOfScreen];
+    [self addChangeForInsertionOfRange:NSMakeRange(0, numOfObjects)];
+    // keep the same object at the top of the screen
+    self.updatingTransaction.keepsAnchor = YES;
+    self.updatingTransaction.viewAnimationBlock = animationBlock;
+    [self.updatingTransaction addCompletionBlock:completionBlock];
+    [self endUpdates];
+}
+
+-(void) appendNumOfViews:(NSInteger) numOfObjects animationBlock:(void (^)())animationBlock  completionBlock:(void (^)())completionBlock {
+    [self beginUpdates];
+    [self addChangeForInsertionOfRange:NSMakeRange([self numberOfViewsAfterQueuedUpdates] + [self.updatingTransaction pendingCountChange], numOfObjects)];
+    self.updatingTransaction.keepsAnchor = YES;
+    self.updatingTransaction.viewAnimationBlock = animationBlock;
+    [self.updatingTransaction addCompletionBlock:completionBlock];
+    [self endUpdates];
+}
+
+-(void) removeViewsInRange:(NSRange) range animationBlock:(AHLayoutViewAnimationBlock)animationBlock  completionBlock:(void (^)())completionBlock {
+    [self beginUpdates];
+    [self addChangeForRemovalOfRange:range];
+    self.updatingTransaction.keepsAnchor = YES;
+    self.updatingTransaction.shouldNotCallDelegate = YES;
+    self.updatingTransaction.viewAnimationBlock = animationBlock;
+    [self.updatingTransaction addCompletionBlock:completionBlock];
+    [self endUpdates];
+}
+
+-(void) moveViewAtIndex:(NSUInteger) fromIndex toIndex:(NSUInteger) toIndex {
+    [self moveViewAtIndex:fromIndex toIndex:toIndex animationBlock:nil completionBlock:nil];
+}
+
+-(void) moveViewAtIndex:(NSUInteger) fromIndex toIndex:(NSUInteger) toIndex animationBlock:(void (^)())animationBlock completionBlock:(void (^)())completionBlock {
+    [self moveViews:@{ @(fromIndex) : @(toIndex) } animationBlock:animationBlock completionBlock:completionBlock];
+}
+
+-(void) moveViews:(NSDictionary*) moves animationBlock:(void (^)())animationBlock completionBlock:(void (^)())completionBlock {
+    if (moves.count == 0) return;
+    [self beginUpdates];
+    [self addChangesForInsertions:nil deletions:nil reloads:nil moves:moves];
+    self.updatingTransaction.shouldNotCallDelegate = YES;
+    self.updatingTransaction.animationBlock = animationBlock;
+    [self.updatingTransaction addCompletionBlock:completionBlock];
+    [self endUpdates];
+}
+
+-(void) performBatchUpdatesWithInsertions:(NSIndexSet*) insertions deletions:(NSIndexSet*) deletions reloads:(NSIndexSet*) reloads moves:(NSDictionary*) moves animationBlock:(AHLayoutViewAnimationBlock)animationBlock completionBlock:(void (^)())completionBlock {
+    [self beginUpdates];
+    [self addChangesForInsertions:insertions deletions:deletions reloads:reloads moves:moves];
+    // the data source already has the new objects, sizes are asked for as needed
+    self.updatingTransaction.shouldNotCallDelegate = YES;
     self.updatingTransaction.viewAnimationBlock = animationBlock;
     [self.updatingTransaction addCompletionBlock:completionBlock];
     [self endUpdates];
 }
 
+// Number the identifiers of both snapshots, equal identifiers sharing a
+// number, and let AHLayoutDiff find the changes between them
+-(void) applySnapshotWithIdentifiers:(NSArray*) identifiers reloadedIdentifiers:(NSSet*) reloadedIdentifiers animationBlock:(AHLayoutViewAnimationBlock)animationBlock completionBlock:(void (^)())completionBlock {
+    NSArray *previous = snapshotIdentifiers;
+    identifiers = [identifiers copy];
+    if (!previous) {
+        [self reloadData];
+        snapshotIdentifiers = identifiers;
+        if (completionBlock) completionBlock();
+        return;
+    }
+    NSUInteger oldCount = previous.count;
+    NSUInteger newCount = identifiers.count;
+    size_t *oldItems = malloc(MAX(oldCount, 1) * sizeof(size_t));
+    size_t *newItems = malloc(MAX(newCount, 1) * sizeof(size_t));
+    size_t *oldToNew = malloc(MAX(oldCount, 1) * sizeof(size_t));
+    size_t *newToOld = malloc(MAX(newCount, 1) * sizeof(size_t));
+    bool *moved = malloc(MAX(newCount, 1) * sizeof(bool));
+    NSMapTable *symbols = [NSMapTable strongToStrongObjectsMapTable];
+    size_t (^symbolForIdentifier)(id) = ^size_t(id identifier) {
+        NSNumber *symbol = [symbols objectForKey:identifier];
+        if (!symbol) {
+            symbol = @(symbols.count);
+            [symbols setObject:symbol forKey:identifier];
+        }
+        return [symbol unsignedIntegerValue];
+    };
+    BOOL diffed = oldItems && newItems && oldToNew && newToOld && moved;
+    if (diffed) {
+        for (NSUInteger i = 0; i < oldCount; i++) oldItems[i] = symbolForIdentifier([previous objectAtIndex:i]);
+        for (NSUInteger j = 0; j < newCount; j++) newItems[j] = symbolForIdentifier([identifiers objectAtIndex:j]);
+        diffed = AHLayoutDiff(oldItems, oldCount, newItems, newCount, symbols.count, oldToNew, newToOld, moved);
+    }
+    NSMutableIndexSet *insertions = [NSMutableIndexSet indexSet];
+    NSMutableIndexSet *deletions = [NSMutableIndexSet indexSet];
+    NSMutableIndexSet *reloads = [NSMutableIndexSet indexSet];
+    NSMutableDictionary *moves = [NSMutableDictionary dictionary];
+    if (diffed) {
+        for (NSUInteger i = 0; i < oldCount; i++) {
+            if (oldToNew[i] == AHLayoutNotFound) {
+                [deletions addIndex:i];
+            } else if ([reloadedIdentifiers containsObject:[previous objectAtIndex:i]]) {
+                [reloads addIndex:i];
+            }
+        }
+        for (NSUInteger j = 0; j < newCount; j++) {
+            if (newToOld[j] == AHLayoutNotFound) {
+                [insertions addIndex:j];
+            } else if (moved[j]) {
+                [moves setObject:@(j) forKey:@(newToOld[j])];
+            }
+        }
+    }
+    free(oldItems);
+    free(newItems);
+    free(oldToNew);
+    free(newToOld);
+    free(moved);
+    
+    if (!diffed) {
+        [self reloadData];
+    } else if (insertions.count || deletions.count || reloads.count || moves.count) {
+        [self performBatchUpdatesWithInsertions:insertions deletions:deletions reloads:reloads moves:moves animationBlock:animationBlock completionBlock:completionBlock];
+        completionBlock = nil;
+    }
+    snapshotIdentifiers = identifiers;
+    if (completionBlock) completionBlock();
+}
+
+// A run of new objects as a single change, so the offset index takes it in one
+// O(length + log n) splice and views are rebased once rather than per object.
+// When estimating, the run starts at its estimated sizes and is measured as it
+// comes near the screen.
+-(void) addChangeForInsertionOfRange:(NSRange) range {
+    if (range.length == 0) return;
+    snapshotIdentifiers = nil;
+    BOOL estimatePerObject = [dataSource respondsToSelector:@selector(layout:estimatedSizeOfViewAtIndex:)];
+    BOOL estimating = estimatePerObject || !CGSizeEqualToSize(estimatedViewSize, CGSizeZero);
+    NSMutableData *sizes = [NSMutableData dataWithLength:range.length * 2 * sizeof(double)];
+    double *widths = [sizes mutableBytes];
+    double *heights = widths + range.length;
+    for (NSUInteger i = 0; i < range.length; i++) {
+        NSUInteger index = range.location + i;
+        CGSize size = estimatedViewSize;
+        if (!estimating) {
+            size = [dataSource layout:self sizeOfViewAtIndex:index];
+        } else if (estimatePerObject) {
+            size = [dataSource layout:self estimatedSizeOfViewAtIndex:index];
+        }
+        widths[i] = size.width;
+        heights[i] = size.height;
+    }
+    if (collectsTransactionStatistics && (!estimating || estimatePerObject)) self.runningStatistics->dataSourceCalls += range.length;
+    if (estimating) estimatingSizes = YES;
+    
+    AHLayoutObject *object = [[AHLayoutObject alloc] init];
+    object.markedForInsertion = YES;
+    object.index = range.location;
+    object.length = range.length;
+    object.runSizes = sizes;
+    object.flags = estimating ? AHLayoutObjectFlagInserted : AHLayoutObjectFlagInserted | AHLayoutObjectFlagMeasured;
+    [self.updatingTransaction.changeList addObject:object];
+}
+
+-(void) addChangeForRemovalOfRange:(NSRange) range {
+    if (range.length == 0) return;
+    snapshotIdentifiers = nil;
+    NSAssert(NSMaxRange(range) <= [self numberOfViewsAfterQueuedUpdates] + [self.updatingTransaction pendingCountChange], @"AHLayout object out of range");
+    AHLayoutObject *object = [[AHLayoutObject alloc] init];
+    object.markedForRemoval = YES;
+    object.index = range.location;
+    object.length = range.length;
+    [self.updatingTransaction.changeList addObject:object];
+}
+
+// Turn the index sets into one sorted edit script for the updating transaction.
+// Deletions go highest first against the old indexes, insertions lowest first
+// against the new ones, so no change moves one made before it and every change
+// is a single O(log n) edit of the offset index. A move is a deletion from its
+// old index paired with an insertion at its new one, which keeps its size and
+// view. Reloads come last at the index their object ends up at.
+-(void) addChangesForInsertions:(NSIndexSet*) insertions deletions:(NSIndexSet*) deletions reloads:(NSIndexSet*) reloads moves:(NSDictionary*) moves {
+    // The last snapshot no longer matches the views
+    snapshotIdentifiers = nil;
+    NSMutableArray *changes = self.updatingTransaction.changeList;
+    NSInteger count = [self numberOfViewsAfterQueuedUpdates] + [self.updatingTransaction pendingCountChange];
+    
+    NSMutableIndexSet *allDeletions = [NSMutableIndexSet indexSet];
+    NSMutableIndexSet *allInsertions = [NSMutableIndexSet indexSet];
+    if (deletions) [allDeletions addIndexes:deletions];
+    if (insertions) [allInsertions addIndexes:insertions];
+    NSMutableDictionary *sourceForDestination = [NSMutableDictionary dictionaryWithCapacity:moves.count];
+    [moves enumerateKeysAndObjectsUsingBlock:^(NSNumber *from, NSNumber *to, BOOL *stop) {
+        [allDeletions addIndex:[from unsignedIntegerValue]];
+        [allInsertions addIndex:[to unsignedIntegerValue]];
+        [sourceForDestination setObject:from forKey:to];
+    }];
+    NSAssert(allDeletions.count == deletions.count + moves.count && allInsertions.count == insertions.count + moves.count, @"AHLayout overlapping changes");
+    
+    NSMutableDictionary *removals = [NSMutableDictionary dictionaryWithCapacity:moves.count];
+    [allDeletions enumerateIndexesWithOptions:NSEnumerationReverse usingBlock:^(NSUInteger idx, BOOL *stop) {
+        NSAssert(idx < count, @"AHLayout object out of range");
+        AHLayoutObject *object = [[AHLayoutObject alloc] init];
+        object.markedForRemoval = YES;
+        object.index = idx;
+        [changes addObject:object];
+        if (moves) [removals setObject:object forKey:@(idx)];
+    }];
+    count -= allDeletions.count;
+    [allInsertions enumerateIndexesUsingBlock:^(NSUInteger idx, BOOL *stop) {
+        NSAssert(idx <= count, @"AHLayout object out of range");
+        AHLayoutObject *object = [[AHLayoutObject alloc] init];
+        NSNumber *source = [sourceForDestination objectForKey:@(idx)];
+        if (source) {
+            object.movedFrom = [removals objectForKey:source];
+        } else {
+            object.size = [dataSource layout:self sizeOfViewAtIndex:idx];
+            if (collectsTransactionStatistics) self.runningStatistics->dataSourceCalls++;
+        }
+        object.markedForInsertion = YES;
+        object.index = idx;
+        [changes addObject:object];
+    }];
+    [reloads enumerateIndexesUsingBlock:^(NSUInteger idx, BOOL *stop) {
+        if ([deletions containsIndex:idx]) return;
+        NSNumber *destination = [moves objectForKey:@(idx)];
+        NSUInteger newIndex = [destination unsignedIntegerValue];
+        if (!destination) {
+            // Old index to new: drop the deletions before it, then step over the insertions
+            newIndex = idx - [allDeletions countOfIndexesInRange:NSMakeRange(0, idx)];
+            NSUInteger target = newIndex;
+            NSUInteger inserted;
+            while ((inserted = [allInsertions countOfIndexesInRange:NSMakeRange(0, newIndex + 1)]) != newIndex - target) {
+                newIndex = target + inserted;
+            }
+        }
+        AHLayoutObject *object = [[AHLayoutObject alloc] init];
+        object.size = [dataSource layout:self sizeOfViewAtIndex:newIndex];
+        if (collectsTransactionStatistics) self.runningStatistics->dataSourceCalls++;
+        object.markedForUpdate = YES;
+        object.markedForReload = YES;
+        object.index = newIndex;
+        [changes addObject:object];
+    }];
+}
+
 
 - (NSArray *)visibleViews
 {
-	return [objectViewsMap allValues];
+	return [objectViewsMap allViews];
 }
 
 -(NSUInteger) objectIndexAtTopOfScreen {
-    if (objectViewsMap.allKeys.count >0) {
-        NSArray *sortedIndexes = [[self.objectViewsMap allKeys] sortedArrayUsingSelector:@selector(compareNumberStrings:)];
-        if (sortedIndexes.count > 0) {
-            NSString *indexKey = [sortedIndexes lastObject];
-            return [indexKey integerValue];
+    // the lowest index in the visible rect, the views map also holds the overscan
+    AHLayoutAnchor anchor = self.anchor;
+    return anchor.index == NSNotFound ? -1 : anchor.index;
+}
+
+
+#pragma mark - Getters and Setters
+
+-(void) setTypeOfLayout:(AHLayoutType)type {
+    typeOfLayout = type;
+    // Flow and masonry layouts scroll vertically
+    AHLayoutCoreSetType(core, (AHLayoutCoreType)type);
+}
+
+-(NSUInteger) numberOfColumns {
+    return AHLayoutCoreGetColumnCount(core);
+}
+
+-(void) setNumberOfColumns:(NSUInteger)columns {
+    AHLayoutCoreSetColumnCount(core, columns);
+}
+
+-(void) setSpaceBetweenViews:(CGFloat)space {
+    // Header room includes the spacing
+    [self setSectionLeadsEnabled:NO];
+    spaceBetweenViews = space;
+    AHLayoutOffsetIndexSetSpacing(offsetIndex, space);
+    [self setSectionLeadsEnabled:YES];
+}
+
+#pragma mark - Offset Index
+
+-(BOOL) needsMeasuringForBounds:(CGRect) bounds {
+    return needsMeasuring || !CGSizeEqualToSize(measuredSize, bounds.size);
+}
+
+// Rebuild the offset index from the data source in O(n)
+// When estimating, objects start at their estimated size and are
+// measured for real later by measureObjectsInRange:
+-(void) measureObjects {
+    NSUInteger count = AHLayoutOffsetIndexCount(offsetIndex);
+    BOOL estimatePerObject = [dataSource respondsToSelector:@selector(layout:estimatedSizeOfViewAtIndex:)];
+    estimatingSizes = estimatePerObject || !CGSizeEqualToSize(estimatedViewSize, CGSizeZero);
+    BOOL cached = [self usesSizeCache];
+    if (estimatingSizes && !estimatePerObject && !cached) {
+        AHLayoutOffsetIndexResetUniform(offsetIndex, count, estimatedViewSize.width, estimatedViewSize.height);
+    } else {
+        double *widths = malloc(MAX(count, 1) * sizeof(double));
+        double *heights = malloc(MAX(count, 1) * sizeof(double));
+        // Objects whose size came from the data source rather than a guess
+        NSMutableIndexSet *measuredIndexes = nil;
+        if (cached) {
+            measuredIndexes = [NSMutableIndexSet indexSet];
+            [self copyCachedSizesWithCount:count widths:widths heights:heights measuredIndexes:measuredIndexes];
+        } else if (!estimatingSizes && [dataSource respondsToSelector:@selector(layout:sizesOfViewsInRange:)]) {
+            [self copySizesConcurrentlyWithCount:count widths:widths heights:heights];
+            if (collectsTransactionStatistics) self.runningStatistics->dataSourceCalls += (count + kAHLayoutSizingBatchSize - 1) / kAHLayoutSizingBatchSize;
+        } else {
+            for (NSUInteger i = 0; i < count; i++) {
+                CGSize size = estimatePerObject ? [dataSource layout:self estimatedSizeOfViewAtIndex:i] : [dataSource layout:self sizeOfViewAtIndex:i];
+                widths[i] = size.width;
+                heights[i] = size.height;
+            }
+            if (collectsTransactionStatistics) self.runningStatistics->dataSourceCalls += count;
+        }
+        AHLayoutOffsetIndexReset(offsetIndex, count, widths, heights);
+        if (cached) {
+            // Cached sizes are only good guesses, they're checked like estimates
+            // once their views come near the screen
+            estimatingSizes = [measuredIndexes count] < count;
+            [measuredIndexes enumerateIndexesUsingBlock:^(NSUInteger i, BOOL *stop) {
+                AHLayoutOffsetIndexSetFlags(offsetIndex, i, AHLayoutOffsetIndexGetFlags(offsetIndex, i) | AHLayoutObjectFlagMeasured);
+            }];
         }
+        free(widths);
+        free(heights);
     }
-    return -1;
+    [self objectsChangedFromIndex:0];
+    [self reloadSections];
+    measuredSize = self.bounds.size;
+    needsMeasuring = NO;
 }
 
+// Sizes from the size cache where it has them. The others are estimated when
+// the data source can estimate, otherwise measured and added to the cache.
+-(void) copyCachedSizesWithCount:(NSUInteger) count widths:(double*) widths heights:(double*) heights measuredIndexes:(NSMutableIndexSet*) measuredIndexes {
+    BOOL estimatePerObject = [dataSource respondsToSelector:@selector(layout:estimatedSizeOfViewAtIndex:)];
+    BOOL estimateUniform = !estimatePerObject && !CGSizeEqualToSize(estimatedViewSize, CGSizeZero);
+    CGFloat crossExtent = [self sizeCacheCrossExtent];
+    for (NSUInteger i = 0; i < count; i++) {
+        uint64_t key = [self sizeCacheKeyForIndex:i];
+        if (AHLayoutSizeCacheGet(sizeCache, key, crossExtent, &widths[i], &heights[i])) continue;
+        CGSize size;
+        if (estimateUniform) {
+            size = estimatedViewSize;
+        } else if (estimatePerObject) {
+            size = [dataSource layout:self estimatedSizeOfViewAtIndex:i];
+            if (collectsTransactionStatistics) self.runningStatistics->dataSourceCalls++;
+        } else {
+            size = [dataSource layout:self sizeOfViewAtIndex:i];
+            if (collectsTransactionStatistics) self.runningStatistics->dataSourceCalls++;
+            AHLayoutSizeCacheSet(sizeCache, key, crossExtent, size.width, size.height);
+            [measuredIndexes addIndex:i];
+        }
+        widths[i] = size.width;
+        heights[i] = size.height;
+    }
+}
 
-#pragma mark - Getters and Setters
+// Fan the data source's batch sizing out across the cores, each batch writes
+// to its own slice of the arrays. This blocks until every batch is done so
+// the offset index is only ever built and read on the main thread.
+-(void) copySizesConcurrentlyWithCount:(NSUInteger) count widths:(double*) widths heights:(double*) heights {
+    NSObject<AHLayoutDataSource> *source = dataSource;
+    size_t batches = (count + kAHLayoutSizingBatchSize - 1) / kAHLayoutSizingBatchSize;
+    dispatch_apply(batches, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t batch) {
+        NSRange range = NSMakeRange(batch * kAHLayoutSizingBatchSize, kAHLayoutSizingBatchSize);
+        range.length = MIN(range.length, count - range.location);
+        @autoreleasepool {
+            NSArray *sizes = [source layout:self sizesOfViewsInRange:range];
+            for (NSUInteger i = 0; i < range.length; i++) {
+                CGSize size = i < sizes.count ? [[sizes objectAtIndex:i] sizeValue] : CGSizeZero;
+                widths[range.location + i] = size.width;
+                heights[range.location + i] = size.height;
+            }
+        }
+    });
+}
+
+-(void) setSizeCachePath:(NSString *) path {
+    sizeCachePath = [path copy];
+    AHLayoutSizeCacheClose(sizeCache);
+    sizeCache = path ? AHLayoutSizeCacheOpen([path fileSystemRepresentation], kAHLayoutSizeCacheMaximumCount) : NULL;
+    if (path && !sizeCache) NSLog(@"!!! Warning: could not open the size cache at %@", path);
+}
+
+-(BOOL) usesSizeCache {
+    return sizeCache && [dataSource respondsToSelector:@selector(layout:identifierOfViewAtIndex:)];
+}
+
+// Asks the data source for the identifier, counted as a call like the sizes
+-(uint64_t) sizeCacheKeyForIndex:(NSUInteger) index {
+    if (collectsTransactionStatistics) self.runningStatistics->dataSourceCalls++;
+    const char *identifier = [[dataSource layout:self identifierOfViewAtIndex:index] UTF8String];
+    return identifier ? AHLayoutSizeCacheKey(identifier, strlen(identifier)) : 0;
+}
+
+// Sizes depend on the width of vertical layouts and the height of horizontal ones
+-(CGFloat) sizeCacheCrossExtent {
+    return typeOfLayout == AHLayoutHorizontal ? self.bounds.size.height : self.bounds.size.width;
+}
+
+// Ask the data source for the real size of any object in range still at its
+// estimate, O(log n) per object. Returns YES if any size changed.
+-(BOOL) measureObjectsInRange:(NSRange) range {
+    if (!estimatingSizes) return NO;
+    BOOL changed = NO;
+    BOOL cached = [self usesSizeCache];
+    CGFloat crossExtent = [self sizeCacheCrossExtent];
+    NSUInteger end = MIN(NSMaxRange(range), AHLayoutOffsetIndexCount(offsetIndex));
+    for (NSUInteger i = range.location; i < end; i++) {
+        unsigned char flags = AHLayoutOffsetIndexGetFlags(offsetIndex, i);
+        if (flags & AHLayoutObjectFlagMeasured) continue;
+        CGSize size = [dataSource layout:self sizeOfViewAtIndex:i];
+        if (collectsTransactionStatistics) self.runningStatistics->dataSourceCalls++;
+        double width, height;
+        AHLayoutOffsetIndexGetSize(offsetIndex, i, &width, &height);
+        if (width != size.width || height != size.height) {
+            AHLayoutOffsetIndexSetSize(offsetIndex, i, size.width, size.height);
+            [self objectResizedAtIndex:i];
+            changed = YES;
+        }
+        if (cached) {
+            AHLayoutSizeCacheSet(sizeCache, [self sizeCacheKeyForIndex:i], crossExtent, size.width, size.height);
+        }
+        AHLayoutOffsetIndexSetFlags(offsetIndex, i, flags | AHLayoutObjectFlagMeasured);
+    }
+    return changed;
+}
+
+// Anything depending on the sizes of the objects from index on is out of date
+-(void) objectsChangedFromIndex:(NSUInteger) index {
+    AHLayoutCoreItemsChanged(core, index);
+}
+
+// Same for a change in size, which a masonry layout absorbs within the column
+-(void) objectResizedAtIndex:(NSUInteger) index {
+    AHLayoutCoreItemResized(core, index);
+}
+
+// Flow and masonry layouts are packed for the current width, again if anything changed
+-(AHLayoutCore*) core {
+    AHLayoutCoreSetBoundsSize(core, AHSizeFromCGSize(self.bounds.size));
+    return core;
+}
+
+// Walks the frames of the objects in range in order, O(log n + range.length)
+-(void) enumerateObjectFramesInRange:(NSRange) range usingBlock:(void (^)(NSUInteger index, CGRect frame, BOOL *stop))block {
+    if (typeOfLayout == AHLayoutFlow || typeOfLayout == AHLayoutMasonry) {
+        BOOL stop = NO;
+        NSUInteger end = MIN(NSMaxRange(range), AHLayoutOffsetIndexCount(offsetIndex));
+        for (NSUInteger i = range.location; i < end && !stop; i++) {
+            block(i, [self rectForViewAtIndex:i], &stop);
+        }
+        return;
+    }
+    AHLayoutItemGeometry geometry[128];
+    BOOL horizontal = typeOfLayout == AHLayoutHorizontal;
+    BOOL stop = NO;
+    NSUInteger position = range.location;
+    NSUInteger end = NSMaxRange(range);
+    while (position < end && !stop) {
+        size_t copied = AHLayoutOffsetIndexCopyGeometry(offsetIndex, position, MIN(end - position, 128), geometry);
+        if (copied == 0) break;
+        for (size_t i = 0; i < copied && !stop; i++) {
+            AHLayoutItemGeometry g = geometry[i];
+            CGRect frame = horizontal ? CGRectMake(g.offset, 0, g.width, g.height) : CGRectMake(0, g.offset, g.width, g.height);
+            block(position + i, frame, &stop);
+        }
+        position += copied;
+    }
+}
+
+#pragma mark - Prefetching
+
+// Follows the scroll from one layout pass to the next
+-(void) updateScrollSpeed {
+    BOOL horizontal = typeOfLayout == AHLayoutHorizontal;
+    CGRect visible = self.visibleRect;
+    CGFloat position = horizontal ? visible.origin.x : visible.origin.y;
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    CGFloat delta = position - lastScrollPosition;
+    CFAbsoluteTime elapsed = now - lastScrollTime;
+    lastScrollPosition = position;
+    lastScrollTime = now;
+    if (delta != 0) scrollDirection = delta > 0 ? 1 : -1;
+    if (_throw.throwing) {
+        scrollSpeed = fabs(horizontal ? _throw.vx : _throw.vy);
+    } else {
+        // Layout passes a long way apart mean the scroll stopped in between
+        scrollSpeed = (elapsed > 0 && elapsed < kAHLayoutPrefetchLookahead) ? fabs(delta) / elapsed : 0;
+    }
+}
 
+-(CGRect) overscanRectForVisibleRect:(CGRect) visible {
+    BOOL horizontal = typeOfLayout == AHLayoutHorizontal;
+    CGFloat screen = horizontal ? visible.size.width : visible.size.height;
+    CGFloat leading = overscan.leading + overscan.leadingFraction * screen;
+    CGFloat trailing = overscan.trailing + overscan.trailingFraction * screen;
+    if (overscan.velocityLookahead > 0) {
+        leading += MIN(scrollSpeed * overscan.velocityLookahead, screen * kAHLayoutMaxPrefetchScreens);
+    }
+    if (leading <= 0 && trailing <= 0) return visible;
+    if (scrollDirection == 0) trailing = leading = MAX(leading, trailing);
+    CGFloat before = MAX(scrollDirection < 0 ? leading : trailing, 0);
+    CGFloat after = MAX(scrollDirection < 0 ? trailing : leading, 0);
+    if (horizontal) {
+        return CGRectMake(visible.origin.x - before, visible.origin.y, visible.size.width + before + after, visible.size.height);
+    }
+    return CGRectMake(visible.origin.x, visible.origin.y - before, visible.size.width, visible.size.height + before + after);
+}
+
+// Works out the window of views about to come on screen and tells the prefetch
+// data source what entered and left it since the last layout pass.
+// The window reaches as far as the scroll is expected to travel: where a throw
+// will coast to, or where a drag will be shortly at its current speed.
+-(void) updatePrefetching {
+    if (!prefetchDataSource) return;
+    BOOL horizontal = typeOfLayout == AHLayoutHorizontal;
+    CGRect visible = self.visibleRect;
+    CGFloat screen = horizontal ? visible.size.width : visible.size.height;
+    
+    CGFloat ahead;
+    if (_throw.throwing) {
+        // Every frame of a throw keeps decelerationRate of the speed, so the
+        // distance left is a geometric series
+        CGFloat rate = MIN(self.decelerationRate, 0.99);
+        ahead = scrollSpeed / kAHLayoutThrowFramesPerSecond * rate / (1 - rate);
+    } else {
+        ahead = scrollSpeed * kAHLayoutPrefetchLookahead;
+    }
+    ahead = MIN(MAX(ahead, screen / 2), screen * kAHLayoutMaxPrefetchScreens);
+    // Half a screen behind as well until the scroll has a direction
+    CGFloat behind = scrollDirection == 0 ? screen / 2 : 0;
+    CGFloat before = scrollDirection < 0 ? ahead : behind;
+    CGFloat after = scrollDirection > 0 ? ahead : behind;
+    CGRect window = horizontal ? CGRectMake(visible.origin.x - before, visible.origin.y, visible.size.width + before + after, visible.size.height) : CGRectMake(visible.origin.x, visible.origin.y - before, visible.size.width, visible.size.height + before + after);
+    
+    AHLayoutTransaction *transaction = self.executingTransaction ? self.executingTransaction : defaultTransaction;
+    // Views in the overscan already exist
+    NSIndexSet *visibleIndexes = [transaction objectIndexesInRect:[self overscanRectForVisibleRect:visible]];
+    NSMutableIndexSet *indexes = [[transaction objectIndexesInRect:window] mutableCopy];
+    [indexes removeIndexes:visibleIndexes];
+    
+    // Views that came on screen were prefetched for, the rest left the window
+    NSMutableIndexSet *cancelled = [prefetchedIndexes mutableCopy];
+    [cancelled removeIndexes:indexes];
+    [cancelled removeIndexes:visibleIndexes];
+    NSMutableIndexSet *added = [indexes mutableCopy];
+    [added removeIndexes:prefetchedIndexes];
+    prefetchedIndexes = indexes;
+    
+    if (cancelled.count > 0 && [prefetchDataSource respondsToSelector:@selector(layout:cancelPrefetchingForIndexes:)]) {
+        [prefetchDataSource layout:self cancelPrefetchingForIndexes:cancelled];
+    }
+    if (added.count > 0) {
+        [prefetchDataSource layout:self prefetchIndexes:added];
+    }
+}
+
+-(void) cancelPrefetching {
+    if (prefetchedIndexes.count == 0) return;
+    NSIndexSet *cancelled = prefetchedIndexes;
+    prefetchedIndexes = [NSMutableIndexSet indexSet];
+    if ([prefetchDataSource respondsToSelector:@selector(layout:cancelPrefetchingForIndexes:)]) {
+        [prefetchDataSource layout:self cancelPrefetchingForIndexes:cancelled];
+    }
+}
+
+#pragma mark - Sections
+
+// Ask the data source for its sections. Headers get room in front of the
+// first view of their section in the offset index, so offsets, content size
+// and visible ranges take them into account without any extra work.
+-(void) reloadSections {
+    NSUInteger numberOfObjects = AHLayoutOffsetIndexCount(offsetIndex);
+    NSUInteger count = 0;
+    if ([dataSource respondsToSelector:@selector(numberOfSectionsInLayout:)] && [dataSource respondsToSelector:@selector(layout:numberOfViewsInSection:)]) {
+        count = [dataSource numberOfSectionsInLayout:self];
+        if (collectsTransactionStatistics) self.runningStatistics->dataSourceCalls += 1 + count;
+    }
+    size_t *itemCounts = malloc(MAX(count, 1) * sizeof(size_t));
+    NSUInteger total = 0;
+    for (NSUInteger i = 0; i < count; i++) {
+        itemCounts[i] = [dataSource layout:self numberOfViewsInSection:i];
+        total += itemCounts[i];
+    }
+    if (count > 0 && total != numberOfObjects) {
+        NSLog(@"!!! Warning: sections hold %ld views but the layout has %ld", total, numberOfObjects);
+        NSInteger last = (NSInteger)itemCounts[count - 1] + (NSInteger)numberOfObjects - (NSInteger)total;
+        itemCounts[count - 1] = MAX(last, 0);
+    }
+    // Header views are kept by section, which no longer lines up once sections come or go
+    if (count != AHLayoutSectionIndexCount(sectionIndex)) {
+        for (TUIView *header in [headerViews allValues]) {
+            [header removeFromSuperview];
+        }
+        [headerViews removeAllObjects];
+    }
+    AHLayoutSectionIndexReset(sectionIndex, count, itemCounts);
+    free(itemCounts);
+    
+    BOOL hasHeaders = [dataSource respondsToSelector:@selector(layout:sizeOfHeaderInSection:)] && [dataSource respondsToSelector:@selector(layout:viewForHeaderInSection:)];
+    for (NSUInteger i = 0; i < count && hasHeaders; i++) {
+        CGSize size = [dataSource layout:self sizeOfHeaderInSection:i];
+        AHLayoutSectionIndexSetHeaderExtent(sectionIndex, i, typeOfLayout == AHLayoutHorizontal ? size.width : size.height);
+    }
+    if (collectsTransactionStatistics && hasHeaders) self.runningStatistics->dataSourceCalls += count;
+    [self setSectionLeadsEnabled:YES];
+}
+
+// Adds or takes away the header room on the first view of every section, O(sections log n)
+-(void) setSectionLeadsEnabled:(BOOL) enabled {
+    if (typeOfLayout != AHLayoutVertical && typeOfLayout != AHLayoutHorizontal) return;
+    NSUInteger count = AHLayoutSectionIndexCount(sectionIndex);
+    for (NSUInteger section = 0; section < count; section++) {
+        size_t first = AHLayoutSectionIndexFirstItem(sectionIndex, section);
+        double lead = enabled ? AHLayoutSectionIndexLeadOfItem(sectionIndex, first, spaceBetweenViews) : 0;
+        AHLayoutOffsetIndexSetLead(offsetIndex, first, lead);
+    }
+}
+
+-(NSUInteger) numberOfSections {
+    return AHLayoutSectionIndexCount(sectionIndex);
+}
+
+-(NSUInteger) sectionForViewAtIndex:(NSUInteger) index {
+    return AHLayoutSectionIndexSectionOfItem(sectionIndex, index);
+}
+
+-(NSRange) rangeOfViewsInSection:(NSUInteger) section {
+    return NSMakeRange(AHLayoutSectionIndexFirstItem(sectionIndex, section), AHLayoutSectionIndexItemCountInSection(sectionIndex, section));
+}
+
+-(TUIView*) headerViewForSection:(NSUInteger) section {
+    return [headerViews objectForKey:[NSNumber numberWithUnsignedInteger:section]];
+}
+
+// Where the header sits in the room in front of its section's first view
+-(CGRect) rectForHeaderInSection:(NSUInteger) section {
+    if (typeOfLayout != AHLayoutVertical && typeOfLayout != AHLayoutHorizontal) return CGRectZero;
+    double extent = AHLayoutSectionIndexGetHeaderExtent(sectionIndex, section);
+    if (extent <= 0) return CGRectZero;
+    size_t first = AHLayoutSectionIndexFirstItem(sectionIndex, section);
+    if (first >= AHLayoutOffsetIndexCount(offsetIndex)) return CGRectZero;
+    CGRect r = [self rectForViewAtIndex:first];
+    double lead = AHLayoutOffsetIndexGetLead(offsetIndex, first);
+    double offsetInLead = AHLayoutSectionIndexHeaderOffsetInLead(sectionIndex, section, spaceBetweenViews);
+    if (typeOfLayout == AHLayoutHorizontal) {
+        return CGRectMake(r.origin.x - lead + offsetInLead, 0, extent, self.bounds.size.height);
+    }
+    CGFloat top = r.origin.y + r.size.height + lead - offsetInLead;
+    return CGRectMake(0, top - extent, self.bounds.size.width, extent);
+}
+
+// Bring in the headers of the sections in range and let go of the rest.
+// Only the header of the topmost section can be sticky, so each pass looks
+// at two headers and never at the other sections.
+-(void) layoutHeadersInRect:(CGRect) rect objectRange:(NSRange) range {
+    if (AHLayoutSectionIndexCount(sectionIndex) == 0 || ![dataSource respondsToSelector:@selector(layout:viewForHeaderInSection:)]) return;
+    NSMutableSet *visibleSections = [NSMutableSet set];
+    NSUInteger topSection = NSNotFound;
+    if (range.length > 0) {
+        topSection = AHLayoutSectionIndexSectionOfItem(sectionIndex, range.location);
+        NSUInteger firstSection = topSection;
+        // Empty sections before it keep their headers in the same room
+        while (firstSection > 0 && AHLayoutSectionIndexFirstItem(sectionIndex, firstSection - 1) == AHLayoutSectionIndexFirstItem(sectionIndex, topSection)) {
+            firstSection--;
+        }
+        NSUInteger lastSection = AHLayoutSectionIndexSectionOfItem(sectionIndex, NSMaxRange(range) - 1);
+        for (NSUInteger section = firstSection; section <= lastSection; section++) {
+            if (AHLayoutSectionIndexGetHeaderExtent(sectionIndex, section) > 0) {
+                [visibleSections addObject:[NSNumber numberWithUnsignedInteger:section]];
+            }
+        }
+    }
+    
+    for (NSNumber *section in [headerViews allKeys]) {
+        if (![visibleSections containsObject:section]) {
+            [[headerViews objectForKey:section] removeFromSuperview];
+            [headerViews removeObjectForKey:section];
+        }
+    }
+    
+    for (NSNumber *section in visibleSections) {
+        NSUInteger s = [section unsignedIntegerValue];
+        TUIView *header = [headerViews objectForKey:section];
+        if (!header) {
+            header = [dataSource layout:self viewForHeaderInSection:s];
+            if (collectsTransactionStatistics) self.runningStatistics->dataSourceCalls++;
+            if (!header) continue;
+            [headerViews setObject:header forKey:section];
+            [self addSubview:header];
+        }
+        CGRect frame = [self rectForHeaderInSection:s];
+        if (stickyHeaders && s == topSection) {
+            CGRect next = [self rectForHeaderInSection:s + 1];
+            BOOL hasNext = !CGRectEqualToRect(next, CGRectZero);
+            if (typeOfLayout == AHLayoutHorizontal) {
+                frame.origin.x = MAX(frame.origin.x, CGRectGetMinX(rect));
+                if (hasNext) frame.origin.x = MIN(frame.origin.x, next.origin.x - spaceBetweenViews - frame.size.width);
+            } else {
+                frame.origin.y = MIN(frame.origin.y, CGRectGetMaxY(rect) - frame.size.height);
+                if (hasNext) frame.origin.y = MAX(frame.origin.y, CGRectGetMaxY(next) + spaceBetweenViews);
+            }
+        }
+        if (!CGRectEqualToRect(header.frame, frame)) {
+            header.frame = frame;
+        }
+        [self bringSubviewToFront:header];
+    }
+}
 
 #pragma mark - View Reuse
 
+- (void) registerClass:(Class)poolViewClass forReuseIdentifier:(NSString *)identifier
+{
+    [self reusePoolForIdentifier:identifier].viewClass = poolViewClass;
+}
+
+- (TUIView *) dequeueReusableViewWithIdentifier:(NSString *)identifier
+{
+    AHLayoutReusePool *pool = [self reusePoolForIdentifier:identifier];
+    TUIView *v = [pool.views lastObject];
+    if (v) {
+        [pool.views removeLastObject];
+        pool.hits += 1;
+        if (collectsTransactionStatistics) self.runningStatistics->viewsDequeued++;
+    } else {
+        v = [self createViewWithIdentifier:identifier];
+        pool.misses += 1;
+    }
+    return v;
+}
+
 - (void) enqueueReusableView:(TUIView *)view
 {
-	if(!reusableViews) {
-		reusableViews = [[NSMutableArray alloc] init];
-	}
+    AHLayoutReusePool *pool = [self reusePoolForIdentifier:objc_getAssociatedObject(view, &AHLayoutReuseIdentifierKey)];
+    if (collectsTransactionStatistics) self.runningStatistics->viewsRecycled++;
+    if (pool.views.count >= pool.maximumCount) {
+        pool.discards += 1;
+        return;
+    }
     view.alpha = 1;
-	[reusableViews addObject:view];
+	[pool.views addObject:view];
 }
 
+- (void) setMaximumReusableViews:(NSUInteger)count forReuseIdentifier:(NSString *)identifier
+{
+    AHLayoutReusePool *pool = [self reusePoolForIdentifier:identifier];
+    pool.maximumCount = count;
+    [pool trimToCount:count];
+}
+
+- (void) prewarmReusableViews:(NSUInteger)count forReuseIdentifier:(NSString *)identifier
+{
+    AHLayoutReusePool *pool = [self reusePoolForIdentifier:identifier];
+    count = MIN(count, pool.maximumCount);
+    while (pool.views.count < count) {
+        [pool.views addObject:[self createViewWithIdentifier:identifier]];
+    }
+}
+
+- (void) trimReusableViews
+{
+    for (AHLayoutReusePool *pool in [reusePools allValues]) {
+        [pool trimToCount:pool.views.count / 2];
+    }
+}
+
+- (void) purgeReusableViews
+{
+    for (AHLayoutReusePool *pool in [reusePools allValues]) {
+        [pool trimToCount:0];
+    }
+}
+
+- (AHLayoutReuseStatistics) reuseStatisticsForIdentifier:(NSString *)identifier
+{
+    AHLayoutReusePool *pool = [reusePools objectForKey:identifier ? identifier : kAHLayoutDefaultReuseIdentifier];
+    AHLayoutReuseStatistics statistics = {pool.hits, pool.misses, pool.discards, pool.views.count};
+    return statistics;
+}
+
+- (void) handleMemoryPressure:(unsigned long)level
+{
+#ifdef DISPATCH_SOURCE_TYPE_MEMORYPRESSURE
+    if (level & DISPATCH_MEMORYPRESSURE_CRITICAL) {
+        [self purgeReusableViews];
+    } else if (level & DISPATCH_MEMORYPRESSURE_WARN) {
+        [self trimReusableViews];
+    }
+#endif
+}
 
-- (TUIView *)createView {
-    TUIView *v = [[self.viewClass alloc] initWithFrame:CGRectZero];
+- (AHLayoutReusePool *) reusePoolForIdentifier:(NSString *)identifier
+{
+    if (!identifier) identifier = kAHLayoutDefaultReuseIdentifier;
+    AHLayoutReusePool *pool = [reusePools objectForKey:identifier];
+    if (!pool) {
+        pool = [[AHLayoutReusePool alloc] init];
+        [reusePools setObject:pool forKey:identifier];
+    }
+    return pool;
+}
+
+// Views remember the identifier they were made for, so they go back to the right pool
+- (TUIView *)createViewWithIdentifier:(NSString *)identifier {
+    if (!identifier) identifier = kAHLayoutDefaultReuseIdentifier;
+    Class poolViewClass = [self reusePoolForIdentifier:identifier].viewClass;
+    TUIView *v = [[(poolViewClass ? poolViewClass : self.viewClass) alloc] initWithFrame:CGRectZero];
+    objc_setAssociatedObject(v, &AHLayoutReuseIdentifierKey, identifier, OBJC_ASSOCIATION_COPY_NONATOMIC);
+    if (collectsTransactionStatistics) self.runningStatistics->viewsCreated++;
     return v;
 }
 
+#pragma mark - Statistics
+
+-(void) setCollectsTransactionStatistics:(BOOL)collects {
+    collectsTransactionStatistics = collects;
+    memset(&pendingStatistics, 0, sizeof(pendingStatistics));
+}
+
+// Each transaction counts its own work, what happens between transactions
+// waits for the next one
+-(AHLayoutTransactionStatistics*) runningStatistics {
+    if (!collectsTransactionStatistics) return NULL;
+    AHLayoutTransaction *transaction = self.countingTransaction ? self.countingTransaction : self.executingTransaction;
+    AHLayoutTransactionStatistics *statistics = [transaction runningStatistics];
+    return statistics ? statistics : &pendingStatistics;
+}
+
+-(AHLayoutTransactionStatistics) takePendingTransactionStatistics {
+    AHLayoutTransactionStatistics statistics = pendingStatistics;
+    memset(&pendingStatistics, 0, sizeof(pendingStatistics));
+    return statistics;
+}
+
+// Hands a finished transaction's statistics out
+-(void) reportTransactionStatistics:(AHLayoutTransactionStatistics) statistics {
+    if (!collectsTransactionStatistics) return;
+    lastTransactionStatistics = statistics;
+    if (transactionStatisticsHandler) transactionStatisticsHandler(self, lastTransactionStatistics);
+}
+
 -(NSInteger) numberOfViews {
-    NSInteger numberOfCells = [self.objects count];
-    return numberOfCells;
+    return AHLayoutOffsetIndexCount(offsetIndex);
 }
 
 
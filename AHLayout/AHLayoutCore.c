@@ -0,0 +1,384 @@
+//
+//  AHLayoutCore.c
+//  AHLayout
+//
+//  Copyright (c) 2013 Airheart. All rights reserved.
+//
+
+#include "AHLayoutCore.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+struct AHLayoutCore {
+	AHLayoutCoreType type;
+	AHLayoutSize bounds;
+	AHLayoutOffsetIndex *items;
+	AHLayoutFlowIndex *flow;
+	AHLayoutMasonryIndex *masonry;
+};
+
+AHLayoutCore *AHLayoutCoreCreate(void) {
+	AHLayoutCore *core = calloc(1, sizeof(AHLayoutCore));
+	if (!core) return NULL;
+	core->items = AHLayoutOffsetIndexCreate(AHLayoutOffsetIndexAxisVertical, 0);
+	core->flow = AHLayoutFlowIndexCreate();
+	core->masonry = AHLayoutMasonryIndexCreate(2);
+	if (!core->items || !core->flow || !core->masonry) {
+		AHLayoutCoreFree(core);
+		return NULL;
+	}
+	return core;
+}
+
+void AHLayoutCoreFree(AHLayoutCore *core) {
+	if (!core) return;
+	AHLayoutOffsetIndexFree(core->items);
+	AHLayoutFlowIndexFree(core->flow);
+	AHLayoutMasonryIndexFree(core->masonry);
+	free(core);
+}
+
+void AHLayoutCoreSetType(AHLayoutCore *core, AHLayoutCoreType type) {
+	core->type = type;
+	AHLayoutOffsetIndexSetAxis(core->items, type == AHLayoutCoreHorizontal ? AHLayoutOffsetIndexAxisHorizontal : AHLayoutOffsetIndexAxisVertical);
+}
+
+AHLayoutCoreType AHLayoutCoreGetType(const AHLayoutCore *core) {
+	return core->type;
+}
+
+bool AHLayoutCoreIsHorizontal(const AHLayoutCore *core) {
+	return core->type == AHLayoutCoreHorizontal;
+}
+
+void AHLayoutCoreSetColumnCount(AHLayoutCore *core, size_t columnCount) {
+	AHLayoutMasonryIndexSetColumnCount(core->masonry, columnCount);
+}
+
+size_t AHLayoutCoreGetColumnCount(const AHLayoutCore *core) {
+	return AHLayoutMasonryIndexGetColumnCount(core->masonry);
+}
+
+void AHLayoutCoreSetBoundsSize(AHLayoutCore *core, AHLayoutSize size) {
+	core->bounds = size;
+}
+
+AHLayoutSize AHLayoutCoreGetBoundsSize(const AHLayoutCore *core) {
+	return core->bounds;
+}
+
+#pragma mark - Items
+
+AHLayoutOffsetIndex *AHLayoutCoreItems(const AHLayoutCore *core) {
+	return core->items;
+}
+
+size_t AHLayoutCoreCount(const AHLayoutCore *core) {
+	return AHLayoutOffsetIndexCount(core->items);
+}
+
+void AHLayoutCoreItemsChanged(AHLayoutCore *core, size_t position) {
+	AHLayoutFlowIndexInvalidate(core->flow, position);
+	AHLayoutMasonryIndexInvalidate(core->masonry, position);
+}
+
+void AHLayoutCoreItemResized(AHLayoutCore *core, size_t position) {
+	AHLayoutFlowIndexInvalidate(core->flow, position);
+	// A masonry layout absorbs a change in size within the column
+	AHLayoutMasonryIndexItemResized(core->masonry, core->items, position);
+}
+
+AHLayoutFlowIndex *AHLayoutCorePackedFlow(AHLayoutCore *core) {
+	AHLayoutFlowIndexUpdate(core->flow, core->items, core->bounds.width);
+	return core->flow;
+}
+
+AHLayoutMasonryIndex *AHLayoutCorePackedMasonry(AHLayoutCore *core) {
+	AHLayoutMasonryIndexUpdate(core->masonry, core->items, core->bounds.width);
+	return core->masonry;
+}
+
+#pragma mark - Geometry
+
+AHLayoutSize AHLayoutCoreContentSize(AHLayoutCore *core) {
+	double extent;
+	switch (core->type) {
+		case AHLayoutCoreFlow:
+			extent = AHLayoutFlowIndexContentExtent(AHLayoutCorePackedFlow(core));
+			break;
+		case AHLayoutCoreMasonry:
+			extent = AHLayoutMasonryIndexContentExtent(AHLayoutCorePackedMasonry(core));
+			break;
+		default:
+			extent = AHLayoutOffsetIndexContentExtent(core->items);
+			break;
+	}
+	AHLayoutSize size = core->bounds;
+	if (core->type == AHLayoutCoreHorizontal) {
+		size.width = extent;
+	} else {
+		size.height = extent;
+	}
+	return size;
+}
+
+AHLayoutItemFrame AHLayoutCoreFrameOfItem(AHLayoutCore *core, size_t position) {
+	AHLayoutItemFrame frame = {0, 0, 0, 0};
+	if (position >= AHLayoutOffsetIndexCount(core->items)) return frame;
+	switch (core->type) {
+		case AHLayoutCoreFlow:
+			return AHLayoutFlowIndexFrameOfItem(AHLayoutCorePackedFlow(core), core->items, position);
+		case AHLayoutCoreMasonry:
+			return AHLayoutMasonryIndexFrameOfItem(AHLayoutCorePackedMasonry(core), position);
+		default: {
+			AHLayoutItemGeometry g = AHLayoutOffsetIndexGeometryOfItem(core->items, position);
+			if (core->type == AHLayoutCoreHorizontal) {
+				frame.x = g.offset;
+			} else {
+				frame.y = g.offset;
+			}
+			frame.width = g.width;
+			frame.height = g.height;
+			return frame;
+		}
+	}
+}
+
+bool AHLayoutCoreItemsInRect(AHLayoutCore *core, AHLayoutItemFrame rect, size_t *first, size_t *count) {
+	*first = 0;
+	*count = 0;
+	if (rect.width <= 0 || rect.height <= 0) return false;
+	switch (core->type) {
+		case AHLayoutCoreHorizontal:
+			return AHLayoutOffsetIndexItemsInExtent(core->items, rect.x, rect.x + rect.width, first, count);
+		case AHLayoutCoreFlow:
+			return AHLayoutFlowIndexItemsInExtent(AHLayoutCorePackedFlow(core), rect.y, rect.y + rect.height, first, count);
+		case AHLayoutCoreMasonry:
+			return AHLayoutMasonryIndexItemsInExtent(AHLayoutCorePackedMasonry(core), rect.y, rect.y + rect.height, first, count);
+		default:
+			return AHLayoutOffsetIndexItemsInExtent(core->items, rect.y, rect.y + rect.height, first, count);
+	}
+}
+
+size_t AHLayoutCoreCopyItemsInRect(AHLayoutCore *core, AHLayoutItemFrame rect, size_t *positions, size_t capacity) {
+	if (core->type == AHLayoutCoreMasonry) {
+		if (rect.width <= 0 || rect.height <= 0) return 0;
+		return AHLayoutMasonryIndexCopyItemsInExtent(AHLayoutCorePackedMasonry(core), rect.y, rect.y + rect.height, positions, capacity);
+	}
+	size_t first, count;
+	AHLayoutCoreItemsInRect(core, rect, &first, &count);
+	for (size_t i = 0; i < count && i < capacity; i++) positions[i] = first + i;
+	return count;
+}
+
+static bool AHFrameContainsPoint(AHLayoutItemFrame frame, AHLayoutPoint point) {
+	return point.x >= frame.x && point.x < frame.x + frame.width && point.y >= frame.y && point.y < frame.y + frame.height;
+}
+
+size_t AHLayoutCoreItemAtPoint(AHLayoutCore *core, AHLayoutPoint point) {
+	size_t position;
+	if (core->type == AHLayoutCoreFlow) {
+		return AHLayoutFlowIndexItemAtPoint(AHLayoutCorePackedFlow(core), core->items, point.x, point.y, &position) ? position : AHLayoutNotFound;
+	}
+	if (core->type == AHLayoutCoreMasonry) {
+		return AHLayoutMasonryIndexItemAtPoint(AHLayoutCorePackedMasonry(core), point.x, point.y, &position) ? position : AHLayoutNotFound;
+	}
+	// The items along the main axis at the point, two where they meet
+	double main = core->type == AHLayoutCoreHorizontal ? point.x : point.y;
+	size_t first, count;
+	if (!AHLayoutOffsetIndexItemsInExtent(core->items, main - 0.5, main + 0.5, &first, &count)) return AHLayoutNotFound;
+	for (position = first; position < first + count; position++) {
+		if (AHFrameContainsPoint(AHLayoutCoreFrameOfItem(core, position), point)) return position;
+	}
+	return AHLayoutNotFound;
+}
+
+#pragma mark - Scroll offsets
+
+AHLayoutPoint AHLayoutFixContentOffset(AHLayoutPoint offset, AHLayoutSize contentSize, AHLayoutSize boundsSize) {
+	double mx = offset.x + contentSize.width;
+	if (contentSize.width > boundsSize.width) {
+		if (mx < boundsSize.width) offset.x = boundsSize.width - contentSize.width;
+		if (offset.x > 0) offset.x = 0;
+	} else {
+		if (mx > boundsSize.width) offset.x = boundsSize.width - contentSize.width;
+		if (offset.x < 0) offset.x = 0;
+	}
+
+	double my = offset.y + contentSize.height;
+	if (contentSize.height > boundsSize.height) {
+		if (my < boundsSize.height) offset.y = boundsSize.height - contentSize.height;
+		if (offset.y > 0) offset.y = 0;
+	} else {
+		// Pin to the top
+		offset.y = boundsSize.height - contentSize.height;
+	}
+	return offset;
+}
+
+AHLayoutPoint AHLayoutContentOffsetShowingRect(AHLayoutPoint offset, AHLayoutItemFrame rect, AHLayoutItemFrame visible, bool horizontal) {
+	AHLayoutPoint scrolled = {0, 0};
+	if (horizontal) {
+		if (rect.x + rect.width > visible.x + visible.width) {
+			// Scroll right, rect flush with the right of the visible rect
+			scrolled.x = -rect.x + visible.width - rect.width;
+			return scrolled;
+		} else if (rect.x < visible.x) {
+			// Scroll left, rect flush with the left
+			scrolled.x = -rect.x;
+			return scrolled;
+		}
+	} else if (rect.y < visible.y) {
+		// Scroll down, rect flush with the bottom
+		scrolled.y = -rect.y;
+		return scrolled;
+	} else if (rect.y + rect.height > visible.y + visible.height) {
+		// Scroll up, rect flush with the top
+		scrolled.y = -rect.y + visible.height - rect.height;
+		return scrolled;
+	}
+	return offset;
+}
+
+AHLayoutPoint AHLayoutContentOffsetAfterResize(AHLayoutPoint offset, AHLayoutSize oldContentSize, AHLayoutSize newContentSize, bool horizontal) {
+	if (horizontal && oldContentSize.width > 0) {
+		offset.x = round(oldContentSize.width + offset.x - newContentSize.width);
+	}
+	if (!horizontal && oldContentSize.height > 0) {
+		offset.y = round(oldContentSize.height + offset.y - newContentSize.height);
+	}
+	return offset;
+}
+
+AHLayoutItemFrame AHLayoutVisibleRectForContentOffset(AHLayoutPoint offset, AHLayoutSize boundsSize) {
+	AHLayoutItemFrame visible = {-offset.x, -offset.y, boundsSize.width, boundsSize.height};
+	return visible;
+}
+
+#pragma mark - Edits
+
+size_t AHLayoutEditsPositionAfter(const AHLayoutEdit *edits, size_t count, size_t position) {
+	return AHLayoutEditsPositionAfterEdit(edits, count, 0, position);
+}
+
+size_t AHLayoutEditsPositionAfterEdit(const AHLayoutEdit *edits, size_t count, size_t start, size_t position) {
+	// One past the removal carrying the item while it moves
+	size_t moving = 0;
+	for (size_t i = start; i < count; i++) {
+		const AHLayoutEdit *edit = &edits[i];
+		if (moving) {
+			if (edit->kind == AHLayoutEditInsert && edit->moveSource == moving) {
+				position = edit->position;
+				moving = 0;
+			}
+		} else if (edit->kind == AHLayoutEditRemove) {
+			if (position >= edit->position && position - edit->position < edit->length) {
+				moving = i + 1;
+			} else if (edit->position < position) {
+				position -= edit->length;
+			}
+		} else if (edit->kind == AHLayoutEditInsert) {
+			if (edit->position <= position) position += edit->length;
+		}
+	}
+	return moving ? AHLayoutNotFound : position;
+}
+
+// The positions are slots in ascending order and stay in that order through
+// insertions and removals, so an edit shifts every slot from the first one at
+// or after it: a single update of a Fenwick tree of shifts over the slots.
+// Removed slots are skipped through a union-find of the next live slot, and
+// a moved one is followed on its own from its insertion on.
+typedef struct {
+	const size_t *base;
+	ptrdiff_t *shifts;
+	size_t *next;
+	size_t count;
+} AHRebase;
+
+static void AHRebaseShift(AHRebase *rebase, size_t slot, ptrdiff_t shift) {
+	for (size_t i = slot + 1; i <= rebase->count; i += i & (~i + 1)) rebase->shifts[i] += shift;
+}
+
+static size_t AHRebaseValue(const AHRebase *rebase, size_t slot) {
+	ptrdiff_t shift = 0;
+	for (size_t i = slot + 1; i > 0; i -= i & (~i + 1)) shift += rebase->shifts[i];
+	return (size_t)((ptrdiff_t)rebase->base[slot] + shift);
+}
+
+// The first live slot at or after slot, count if there is none
+static size_t AHRebaseLive(AHRebase *rebase, size_t slot) {
+	size_t root = slot;
+	while (rebase->next[root] != root) root = rebase->next[root];
+	while (rebase->next[slot] != root) {
+		size_t next = rebase->next[slot];
+		rebase->next[slot] = root;
+		slot = next;
+	}
+	return root;
+}
+
+// The first live slot whose position is at least `position`. Whether the next
+// live slot from a slot has reached it only turns from false to true.
+static size_t AHRebaseFirstFrom(AHRebase *rebase, size_t position) {
+	size_t lo = 0, hi = rebase->count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		size_t live = AHRebaseLive(rebase, mid);
+		if (live < rebase->count && AHRebaseValue(rebase, live) < position) {
+			lo = live + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return AHRebaseLive(rebase, lo);
+}
+
+void AHLayoutEditsRebasePositions(const AHLayoutEdit *edits, size_t count, size_t *positions, size_t positionCount) {
+	if (count == 0 || positionCount == 0) return;
+	AHRebase rebase = {positions, calloc(positionCount + 1, sizeof(ptrdiff_t)), malloc((positionCount + 1) * sizeof(size_t)), positionCount};
+	// The slot each single removal takes away, in case an insertion moves it
+	size_t *removed = malloc(count * sizeof(size_t));
+	// Where the moved slots end up
+	size_t *moved = malloc(positionCount * sizeof(size_t));
+	if (!rebase.shifts || !rebase.next || !removed || !moved) {
+		free(rebase.shifts);
+		free(rebase.next);
+		free(removed);
+		free(moved);
+		for (size_t i = 0; i < positionCount; i++) positions[i] = AHLayoutEditsPositionAfter(edits, count, positions[i]);
+		return;
+	}
+	for (size_t i = 0; i <= positionCount; i++) rebase.next[i] = i;
+	for (size_t i = 0; i < positionCount; i++) moved[i] = AHLayoutNotFound;
+
+	for (size_t i = 0; i < count; i++) {
+		const AHLayoutEdit *edit = &edits[i];
+		removed[i] = AHLayoutNotFound;
+		if (edit->kind == AHLayoutEditRemove) {
+			size_t end = edit->position + edit->length;
+			size_t slot = AHRebaseFirstFrom(&rebase, edit->position);
+			while (slot < positionCount && AHRebaseValue(&rebase, slot) < end) {
+				if (edit->length == 1) removed[i] = slot;
+				rebase.next[slot] = slot + 1;
+				slot = AHRebaseLive(&rebase, slot);
+			}
+			if (slot < positionCount) AHRebaseShift(&rebase, slot, -(ptrdiff_t)edit->length);
+		} else if (edit->kind == AHLayoutEditInsert) {
+			size_t slot = AHRebaseFirstFrom(&rebase, edit->position);
+			if (slot < positionCount) AHRebaseShift(&rebase, slot, (ptrdiff_t)edit->length);
+			if (edit->moveSource && edit->moveSource <= i && removed[edit->moveSource - 1] != AHLayoutNotFound) {
+				moved[removed[edit->moveSource - 1]] = AHLayoutEditsPositionAfterEdit(edits, count, i + 1, edit->position);
+			}
+		}
+	}
+
+	for (size_t slot = 0; slot < positionCount; slot++) {
+		positions[slot] = AHRebaseLive(&rebase, slot) == slot ? AHRebaseValue(&rebase, slot) : moved[slot];
+	}
+	free(rebase.shifts);
+	free(rebase.next);
+	free(removed);
+	free(moved);
+}
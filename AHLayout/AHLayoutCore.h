@@ -0,0 +1,157 @@
+//
+//  AHLayoutCore.h
+//  AHLayout
+//
+//  Copyright (c) 2013 Airheart. All rights reserved.
+//
+
+// The geometry behind an AHLayout, with no AppKit or TUIKit dependency.
+//
+// A core owns the offset index holding the sizes of the items and the flow
+// and masonry indexes built on top of it, and answers every question
+// AHLayout asks about where things go: the content size, the frame of an
+// item, the items in a rect or at a point. Alongside it are the scroll offset
+// rules AHLayoutTransaction applies and the rebasing of indexes through a
+// list of edits.
+//
+// Like the indexes it is plain C, so it builds and runs anywhere:
+//
+//   cc -std=c99 -c AHLayout/AHLayoutCore.c AHLayout/AHLayout*Index.c
+//
+// Coordinates follow AHLayout: the origin is bottom left, vertical content
+// starts at the top, and content offsets are negative as in TUIScrollView.
+
+#ifndef AHLayoutCore_h
+#define AHLayoutCore_h
+
+#include "AHLayoutOffsetIndex.h"
+#include "AHLayoutFlowIndex.h"
+#include "AHLayoutMasonryIndex.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Same order as AHLayoutType
+typedef enum {
+	AHLayoutCoreVertical,
+	AHLayoutCoreHorizontal,
+	AHLayoutCoreFlow,
+	AHLayoutCoreMasonry,
+} AHLayoutCoreType;
+
+typedef struct {
+	double x;
+	double y;
+} AHLayoutPoint;
+
+typedef struct {
+	double width;
+	double height;
+} AHLayoutSize;
+
+#define AHLayoutNotFound SIZE_MAX
+
+typedef struct AHLayoutCore AHLayoutCore;
+
+extern AHLayoutCore *AHLayoutCoreCreate(void);
+extern void AHLayoutCoreFree(AHLayoutCore *core);
+
+// Vertical, flow and masonry layouts scroll vertically, horizontal ones
+// horizontally. Changing the type keeps the items.
+extern void AHLayoutCoreSetType(AHLayoutCore *core, AHLayoutCoreType type);
+extern AHLayoutCoreType AHLayoutCoreGetType(const AHLayoutCore *core);
+extern bool AHLayoutCoreIsHorizontal(const AHLayoutCore *core);
+extern void AHLayoutCoreSetColumnCount(AHLayoutCore *core, size_t columnCount);
+extern size_t AHLayoutCoreGetColumnCount(const AHLayoutCore *core);
+
+// Size of the view showing the layout. The width is the line length of a
+// flow layout and what masonry columns share, and the bounds fill the cross
+// axis of the content size.
+extern void AHLayoutCoreSetBoundsSize(AHLayoutCore *core, AHLayoutSize size);
+extern AHLayoutSize AHLayoutCoreGetBoundsSize(const AHLayoutCore *core);
+
+// The items, their sizes, flags and leads. After inserting, removing or
+// resetting items call AHLayoutCoreItemsChanged, after resizing one call
+// AHLayoutCoreItemResized, so the flow and masonry placement follows.
+extern AHLayoutOffsetIndex *AHLayoutCoreItems(const AHLayoutCore *core);
+extern size_t AHLayoutCoreCount(const AHLayoutCore *core);
+extern void AHLayoutCoreItemsChanged(AHLayoutCore *core, size_t position);
+extern void AHLayoutCoreItemResized(AHLayoutCore *core, size_t position);
+
+// Flow and masonry placement packed for the current bounds. Packing is lazy,
+// these only do work after a change.
+extern AHLayoutFlowIndex *AHLayoutCorePackedFlow(AHLayoutCore *core);
+extern AHLayoutMasonryIndex *AHLayoutCorePackedMasonry(AHLayoutCore *core);
+
+extern AHLayoutSize AHLayoutCoreContentSize(AHLayoutCore *core);
+extern AHLayoutItemFrame AHLayoutCoreFrameOfItem(AHLayoutCore *core, size_t position);
+
+// The run of items crossing the rect along the scrolling axis, O(log n).
+// Flow layouts include whole lines, masonry ones every item between the first
+// and last crossing the rect in any column, which is unbounded: columns of
+// very different heights put far-off items inside the run.
+extern bool AHLayoutCoreItemsInRect(AHLayoutCore *core, AHLayoutItemFrame rect, size_t *first, size_t *count);
+
+// Copies up to `capacity` positions of the items crossing the rect and returns
+// how many there are. Only differs from the run above for masonry layouts,
+// where it leaves out the items of the run that are off the rect.
+extern size_t AHLayoutCoreCopyItemsInRect(AHLayoutCore *core, AHLayoutItemFrame rect, size_t *positions, size_t capacity);
+
+// The item whose frame contains the point, AHLayoutNotFound between items.
+extern size_t AHLayoutCoreItemAtPoint(AHLayoutCore *core, AHLayoutPoint point);
+
+// Scroll offsets
+
+// Keeps the offset inside the content, content shorter than the bounds is
+// pinned to the top.
+extern AHLayoutPoint AHLayoutFixContentOffset(AHLayoutPoint offset, AHLayoutSize contentSize, AHLayoutSize boundsSize);
+
+// The smallest scroll that brings rect fully into the visible rect.
+extern AHLayoutPoint AHLayoutContentOffsetShowingRect(AHLayoutPoint offset, AHLayoutItemFrame rect, AHLayoutItemFrame visible, bool horizontal);
+
+// Keeps what is on screen in place when the content changes size. Vertical
+// content grows from the top, so the offset moves by the change in height.
+extern AHLayoutPoint AHLayoutContentOffsetAfterResize(AHLayoutPoint offset, AHLayoutSize oldContentSize, AHLayoutSize newContentSize, bool horizontal);
+
+// The rect of the content shown at a content offset.
+extern AHLayoutItemFrame AHLayoutVisibleRectForContentOffset(AHLayoutPoint offset, AHLayoutSize boundsSize);
+
+// Edits
+
+typedef enum {
+	AHLayoutEditUpdate,
+	AHLayoutEditInsert,
+	AHLayoutEditRemove,
+} AHLayoutEditKind;
+
+// One change in a list applied in order, each against the positions left by
+// the ones before it. An insertion that finishes a move sets moveSource to
+// one past the position in the list of the removal it pairs with. Insertions
+// and removals can cover a run of length items from position on, moves
+// always cover one.
+typedef struct {
+	AHLayoutEditKind kind;
+	size_t position;
+	size_t moveSource;
+	size_t length;
+} AHLayoutEdit;
+
+// Where the item at `position` before the edits is after them, O(edits).
+// Removed items are AHLayoutNotFound, moved ones end up at their insertion.
+extern size_t AHLayoutEditsPositionAfter(const AHLayoutEdit *edits, size_t count, size_t position);
+// Same for an item at `position` once the edits before `start` are applied,
+// such as the item an update in the list refers to.
+extern size_t AHLayoutEditsPositionAfterEdit(const AHLayoutEdit *edits, size_t count, size_t start, size_t position);
+// Rebases many positions in one pass over the edits, replacing each of the
+// ascending `positions` with where it is after them. O((edits + positions)
+// log^2 positions), plus O(edits) for each of the positions that moves.
+extern void AHLayoutEditsRebasePositions(const AHLayoutEdit *edits, size_t count, size_t *positions, size_t positionCount);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+//
+//  AHLayoutDiff.c
+//  AHLayout
+//
+//  Copyright (c) 2013 Airheart. All rights reserved.
+//
+
+#include "AHLayoutDiff.h"
+
+#include <stdlib.h>
+
+#pragma mark - Matching
+
+// Pairs the k-th occurrence of a symbol in the new list with its k-th
+// occurrence in the old one. Old occurrences are chained per symbol, first
+// to last, through next.
+static bool AHMatch(const size_t *oldItems, size_t oldCount, const size_t *newItems, size_t newCount, size_t symbolCount, size_t *oldToNew, size_t *newToOld) {
+	size_t *first = malloc((symbolCount > 0 ? symbolCount : 1) * sizeof(size_t));
+	size_t *next = malloc((oldCount > 0 ? oldCount : 1) * sizeof(size_t));
+	if (!first || !next) {
+		free(first);
+		free(next);
+		return false;
+	}
+	for (size_t s = 0; s < symbolCount; s++) first[s] = AHLayoutNotFound;
+	for (size_t i = oldCount; i-- > 0;) {
+		next[i] = first[oldItems[i]];
+		first[oldItems[i]] = i;
+		oldToNew[i] = AHLayoutNotFound;
+	}
+	for (size_t j = 0; j < newCount; j++) {
+		size_t i = first[newItems[j]];
+		newToOld[j] = i;
+		if (i == AHLayoutNotFound) continue;
+		oldToNew[i] = j;
+		first[newItems[j]] = next[i];
+	}
+	free(first);
+	free(next);
+	return true;
+}
+
+#pragma mark - Moves
+
+// Marks every paired new item as moved except the longest run whose old
+// positions increase in new order. tails[k] is the new index ending the best
+// run of length k + 1 found so far, previous links each item to the one
+// before it in its run.
+static bool AHMarkMoves(const size_t *newToOld, size_t newCount, bool *moved) {
+	size_t *tails = malloc((newCount > 0 ? newCount : 1) * sizeof(size_t));
+	size_t *previous = malloc((newCount > 0 ? newCount : 1) * sizeof(size_t));
+	if (!tails || !previous) {
+		free(tails);
+		free(previous);
+		return false;
+	}
+	size_t length = 0;
+	for (size_t j = 0; j < newCount; j++) {
+		moved[j] = false;
+		size_t i = newToOld[j];
+		if (i == AHLayoutNotFound) continue;
+		moved[j] = true;
+		// Runs mostly grow at the end, check there before searching
+		size_t low = 0, high = length;
+		if (length > 0 && newToOld[tails[length - 1]] < i) {
+			low = length;
+		} else {
+			while (low < high) {
+				size_t middle = low + (high - low) / 2;
+				if (newToOld[tails[middle]] < i) low = middle + 1;
+				else high = middle;
+			}
+		}
+		previous[j] = low > 0 ? tails[low - 1] : AHLayoutNotFound;
+		tails[low] = j;
+		if (low == length) length++;
+	}
+	for (size_t j = length > 0 ? tails[length - 1] : AHLayoutNotFound; j != AHLayoutNotFound; j = previous[j]) {
+		moved[j] = false;
+	}
+	free(tails);
+	free(previous);
+	return true;
+}
+
+bool AHLayoutDiff(const size_t *oldItems, size_t oldCount, const size_t *newItems, size_t newCount, size_t symbolCount, size_t *oldToNew, size_t *newToOld, bool *moved) {
+	if (!AHMatch(oldItems, oldCount, newItems, newCount, symbolCount, oldToNew, newToOld)) return false;
+	return AHMarkMoves(newToOld, newCount, moved);
+}
@@ -0,0 +1,41 @@
+//
+//  AHLayoutDiff.h
+//  AHLayout
+//
+//  Copyright (c) 2013 Airheart. All rights reserved.
+//
+
+// The changes between two lists of items named by identity.
+//
+// Items are symbols, small numbers standing for identifiers, so the same
+// identifier is the same symbol in both lists. Matching follows Heckel: a
+// table over the symbols pairs each new item with an old item of the same
+// symbol in a single pass over each list, in O(n). An identifier that occurs
+// more than once is paired occurrence by occurrence, in order.
+//
+// Paired items that keep their order among each other stay where they are,
+// and the rest of the pairs are moves. The items that stay are the longest
+// increasing run of old positions in new order, found by patience sorting
+// in O(n log n) at worst and O(n) when nothing moved, which keeps the moves
+// to the fewest there can be.
+
+#ifndef AHLayoutDiff_h
+#define AHLayoutDiff_h
+
+#include "AHLayoutCore.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Fills oldToNew with where each old item went and newToOld with where each
+// new item came from, AHLayoutNotFound for removals and insertions, and sets
+// moved for the new items that have to move rather than stay. Symbols must be
+// below symbolCount. Returns false if memory runs out.
+extern bool AHLayoutDiff(const size_t *oldItems, size_t oldCount, const size_t *newItems, size_t newCount, size_t symbolCount, size_t *oldToNew, size_t *newToOld, bool *moved);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,276 @@
+//
+//  AHLayoutFlowIndex.c
+//  AHLayout
+//
+//  Copyright (c) 2013 Airheart. All rights reserved.
+//
+
+#include "AHLayoutFlowIndex.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define AHFlowClean SIZE_MAX
+#define AHFlowChunk 128
+
+struct AHLayoutFlowIndex {
+	AHLayoutOffsetIndexAxis axis;
+	double spacing;
+	double lineLength;
+	bool packed;
+	// First item that needs packing again, AHFlowClean when none do
+	size_t dirty;
+	size_t itemCount;
+	size_t lineCount;
+	size_t lineCapacity;
+	// First item of every line, with the item count after the last line
+	size_t *lineStart;
+	double *lineThickness;
+	// Thickness plus spacing of all the lines before each line
+	double *linePrefix;
+	size_t itemCapacity;
+	// Distance from the start of its line to each item
+	double *crossOffset;
+};
+
+AHLayoutFlowIndex *AHLayoutFlowIndexCreate(void) {
+	AHLayoutFlowIndex *flow = calloc(1, sizeof(AHLayoutFlowIndex));
+	if (!flow) return NULL;
+	flow->dirty = 0;
+	return flow;
+}
+
+void AHLayoutFlowIndexFree(AHLayoutFlowIndex *flow) {
+	if (!flow) return;
+	free(flow->lineStart);
+	free(flow->lineThickness);
+	free(flow->linePrefix);
+	free(flow->crossOffset);
+	free(flow);
+}
+
+void AHLayoutFlowIndexInvalidate(AHLayoutFlowIndex *flow, size_t position) {
+	if (position < flow->dirty) flow->dirty = position;
+}
+
+#pragma mark - Packing
+
+static bool AHFlowGrowLines(AHLayoutFlowIndex *flow, size_t lines) {
+	// One extra for the trailing entries of lineStart and linePrefix
+	if (lines + 1 <= flow->lineCapacity) return true;
+	size_t capacity = flow->lineCapacity < 64 ? 64 : flow->lineCapacity * 2;
+	while (capacity < lines + 1) capacity *= 2;
+	size_t *lineStart = realloc(flow->lineStart, capacity * sizeof(size_t));
+	if (lineStart) flow->lineStart = lineStart;
+	double *lineThickness = realloc(flow->lineThickness, capacity * sizeof(double));
+	if (lineThickness) flow->lineThickness = lineThickness;
+	double *linePrefix = realloc(flow->linePrefix, capacity * sizeof(double));
+	if (linePrefix) flow->linePrefix = linePrefix;
+	if (!lineStart || !lineThickness || !linePrefix) return false;
+	flow->lineCapacity = capacity;
+	return true;
+}
+
+static bool AHFlowGrowItems(AHLayoutFlowIndex *flow, size_t items) {
+	if (items <= flow->itemCapacity) return true;
+	size_t capacity = flow->itemCapacity < 64 ? 64 : flow->itemCapacity;
+	while (capacity < items) capacity *= 2;
+	double *crossOffset = realloc(flow->crossOffset, capacity * sizeof(double));
+	if (!crossOffset) return false;
+	flow->crossOffset = crossOffset;
+	flow->itemCapacity = capacity;
+	return true;
+}
+
+static bool AHFlowCloseLine(AHLayoutFlowIndex *flow, size_t start, double thickness) {
+	if (!AHFlowGrowLines(flow, flow->lineCount + 1)) return false;
+	size_t line = flow->lineCount++;
+	flow->lineStart[line] = start;
+	flow->lineThickness[line] = thickness;
+	flow->linePrefix[line + 1] = flow->linePrefix[line] + thickness + flow->spacing;
+	return true;
+}
+
+bool AHLayoutFlowIndexUpdate(AHLayoutFlowIndex *flow, const AHLayoutOffsetIndex *items, double lineLength) {
+	AHLayoutOffsetIndexAxis axis = AHLayoutOffsetIndexGetAxis(items);
+	double spacing = AHLayoutOffsetIndexGetSpacing(items);
+	size_t count = AHLayoutOffsetIndexCount(items);
+	if (!flow->packed || axis != flow->axis || spacing != flow->spacing || lineLength != flow->lineLength) {
+		flow->dirty = 0;
+	}
+	if (count != flow->itemCount) {
+		// Shouldn't happen if every edit was invalidated, but never read past the end
+		size_t common = count < flow->itemCount ? count : flow->itemCount;
+		AHLayoutFlowIndexInvalidate(flow, common);
+	}
+	if (flow->dirty == AHFlowClean) return true;
+	if (!AHFlowGrowItems(flow, count) || !AHFlowGrowLines(flow, 0)) return false;
+
+	// Start over from the line before the first changed item, that item may
+	// fit at the end of it now
+	size_t line = 0;
+	if (flow->dirty > 0 && flow->lineCount > 0) {
+		line = AHLayoutFlowIndexLineOfItem(flow, flow->dirty);
+		if (line > 0) line--;
+	}
+	size_t position = line < flow->lineCount ? flow->lineStart[line] : 0;
+	if (line == 0) position = 0;
+
+	flow->axis = axis;
+	flow->spacing = spacing;
+	flow->lineLength = lineLength;
+	flow->lineCount = line;
+	flow->linePrefix[0] = 0;
+
+	bool vertical = axis == AHLayoutOffsetIndexAxisVertical;
+	AHLayoutItemGeometry geometry[AHFlowChunk];
+	size_t lineBegin = position;
+	double cursor = spacing;
+	double thickness = 0;
+	while (position < count) {
+		size_t copied = AHLayoutOffsetIndexCopyGeometry(items, position, count - position < AHFlowChunk ? count - position : AHFlowChunk, geometry);
+		if (copied == 0) break;
+		for (size_t i = 0; i < copied; i++, position++) {
+			double cross = vertical ? geometry[i].width : geometry[i].height;
+			double main = vertical ? geometry[i].height : geometry[i].width;
+			// Wrap unless this would leave the line empty
+			if (position > lineBegin && cursor + cross + spacing > lineLength) {
+				if (!AHFlowCloseLine(flow, lineBegin, thickness)) return false;
+				lineBegin = position;
+				cursor = spacing;
+				thickness = 0;
+			}
+			flow->crossOffset[position] = cursor;
+			cursor += cross + spacing;
+			if (main > thickness) thickness = main;
+		}
+	}
+	if (position > lineBegin && !AHFlowCloseLine(flow, lineBegin, thickness)) return false;
+	flow->lineStart[flow->lineCount] = count;
+	flow->itemCount = count;
+	flow->dirty = AHFlowClean;
+	flow->packed = true;
+	return true;
+}
+
+#pragma mark - Queries
+
+size_t AHLayoutFlowIndexLineCount(const AHLayoutFlowIndex *flow) {
+	return flow->lineCount;
+}
+
+size_t AHLayoutFlowIndexLineOfItem(const AHLayoutFlowIndex *flow, size_t position) {
+	if (flow->lineCount == 0) return 0;
+	// Last line starting at or before the item
+	size_t lo = 0, hi = flow->lineCount - 1;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo + 1) / 2;
+		if (flow->lineStart[mid] <= position) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return lo;
+}
+
+double AHLayoutFlowIndexContentExtent(const AHLayoutFlowIndex *flow) {
+	return flow->lineCount > 0 ? flow->linePrefix[flow->lineCount] : 0;
+}
+
+AHLayoutItemFrame AHLayoutFlowIndexFrameOfItem(const AHLayoutFlowIndex *flow, const AHLayoutOffsetIndex *items, size_t position) {
+	AHLayoutItemFrame frame = {0, 0, 0, 0};
+	if (position >= flow->itemCount || position >= AHLayoutOffsetIndexCount(items)) return frame;
+	AHLayoutOffsetIndexGetSize(items, position, &frame.width, &frame.height);
+	size_t line = AHLayoutFlowIndexLineOfItem(flow, position);
+	if (flow->axis == AHLayoutOffsetIndexAxisVertical) {
+		// Rows go top to bottom like the items of a vertical layout,
+		// items sit at the top of their row
+		double rowY = AHLayoutFlowIndexContentExtent(flow) - flow->linePrefix[line + 1] + flow->spacing;
+		frame.x = flow->crossOffset[position];
+		frame.y = rowY + flow->lineThickness[line] - frame.height;
+	} else {
+		// Columns go left to right, items fill them from the top
+		frame.x = flow->spacing + flow->linePrefix[line];
+		frame.y = flow->lineLength - flow->crossOffset[position] - frame.height;
+	}
+	return frame;
+}
+
+// First line whose far edge, linePrefix[line + 1], is past `value`
+static size_t AHFlowFirstLineEndingAfter(const AHLayoutFlowIndex *flow, double value) {
+	size_t lo = 0, hi = flow->lineCount;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (flow->linePrefix[mid + 1] > value) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return lo;
+}
+
+// Number of lines whose near edge, linePrefix[line], is before `value`
+static size_t AHFlowLinesStartingBefore(const AHLayoutFlowIndex *flow, double value) {
+	size_t lo = 0, hi = flow->lineCount;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (flow->linePrefix[mid] < value) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+bool AHLayoutFlowIndexItemsInExtent(const AHLayoutFlowIndex *flow, double start, double end, size_t *first, size_t *count) {
+	*first = 0;
+	*count = 0;
+	if (flow->lineCount == 0 || !(start < end)) return false;
+	double low, high;
+	if (flow->axis == AHLayoutOffsetIndexAxisVertical) {
+		double extent = AHLayoutFlowIndexContentExtent(flow);
+		low = extent - end + flow->spacing;
+		high = extent - start;
+	} else {
+		low = start;
+		high = end - flow->spacing;
+	}
+	size_t firstLine = AHFlowFirstLineEndingAfter(flow, low);
+	size_t endLine = AHFlowLinesStartingBefore(flow, high);
+	if (firstLine >= endLine) return false;
+	*first = flow->lineStart[firstLine];
+	*count = flow->lineStart[endLine] - *first;
+	return *count > 0;
+}
+
+bool AHLayoutFlowIndexItemAtPoint(const AHLayoutFlowIndex *flow, const AHLayoutOffsetIndex *items, double x, double y, size_t *position) {
+	bool vertical = flow->axis == AHLayoutOffsetIndexAxisVertical;
+	double main = vertical ? y : x;
+	// The lines around the point, two where they meet
+	size_t first, count;
+	if (!AHLayoutFlowIndexItemsInExtent(flow, main - 0.5, main + 0.5, &first, &count)) return false;
+	// Distance along the line from where its items start, columns fill from the top
+	double cross = vertical ? x : flow->lineLength - y;
+	for (size_t line = AHLayoutFlowIndexLineOfItem(flow, first); line < flow->lineCount && flow->lineStart[line] < first + count; line++) {
+		// Last item on the line starting at or before the point
+		size_t lo = flow->lineStart[line], hi = flow->lineStart[line + 1];
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+			if (flow->crossOffset[mid] <= cross) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		if (lo == flow->lineStart[line]) continue;
+		AHLayoutItemFrame frame = AHLayoutFlowIndexFrameOfItem(flow, items, lo - 1);
+		if (x >= frame.x && x < frame.x + frame.width && y >= frame.y && y < frame.y + frame.height) {
+			*position = lo - 1;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,63 @@
+//
+//  AHLayoutFlowIndex.h
+//  AHLayout
+//
+//  Copyright (c) 2013 Airheart. All rights reserved.
+//
+
+// Packs the items of an AHLayoutOffsetIndex into lines for AHLayoutFlow.
+//
+// Items are placed one after another across a line of a given length and
+// wrap onto a new line when the next one doesn't fit. With a vertical axis
+// the lines are rows stacked top to bottom, with a horizontal axis they are
+// columns stacked left to right. Each line is as thick as its thickest item.
+//
+// The sizes, axis and spacing are read from the offset index, this only keeps
+// where every line starts and the cumulative line thickness. Lines are found
+// by binary search, so looking up an item or the items in a rect is O(log n).
+// Packing is linear, but only the lines from the first changed item onwards
+// are packed again.
+
+#ifndef AHLayoutFlowIndex_h
+#define AHLayoutFlowIndex_h
+
+#include "AHLayoutOffsetIndex.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AHLayoutFlowIndex AHLayoutFlowIndex;
+
+extern AHLayoutFlowIndex *AHLayoutFlowIndexCreate(void);
+extern void AHLayoutFlowIndexFree(AHLayoutFlowIndex *flow);
+
+// Marks the items from `position` on as needing to be packed again.
+// Call after inserting, removing or resizing items in the offset index.
+extern void AHLayoutFlowIndexInvalidate(AHLayoutFlowIndex *flow, size_t position);
+
+// Packs any invalidated lines. Does nothing when nothing changed, and packs
+// everything again when the line length, axis or spacing did.
+extern bool AHLayoutFlowIndexUpdate(AHLayoutFlowIndex *flow, const AHLayoutOffsetIndex *items, double lineLength);
+
+extern size_t AHLayoutFlowIndexLineCount(const AHLayoutFlowIndex *flow);
+extern size_t AHLayoutFlowIndexLineOfItem(const AHLayoutFlowIndex *flow, size_t position);
+
+// Main-axis length of all the lines, including one spacing per line.
+extern double AHLayoutFlowIndexContentExtent(const AHLayoutFlowIndex *flow);
+
+extern AHLayoutItemFrame AHLayoutFlowIndexFrameOfItem(const AHLayoutFlowIndex *flow, const AHLayoutOffsetIndex *items, size_t position);
+
+// Finds the items on the lines that overlap (start, end) along the main axis
+// in O(log n). Returns false and a zero count if there are none.
+extern bool AHLayoutFlowIndexItemsInExtent(const AHLayoutFlowIndex *flow, double start, double end, size_t *first, size_t *count);
+
+// Finds the item whose frame contains (x, y) in O(log n), a binary search for
+// the line and then along it. Returns false if the point is between items.
+extern bool AHLayoutFlowIndexItemAtPoint(const AHLayoutFlowIndex *flow, const AHLayoutOffsetIndex *items, double x, double y, size_t *position);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
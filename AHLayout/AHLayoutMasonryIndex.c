@@ -0,0 +1,294 @@
+//
+//  AHLayoutMasonryIndex.c
+//  AHLayout
+//
+//  Copyright (c) 2013 Airheart. All rights reserved.
+//
+
+#include "AHLayoutMasonryIndex.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define AHMasonryClean SIZE_MAX
+#define AHMasonryChunk 128
+
+typedef struct {
+	AHLayoutOffsetIndex *index;
+	// Item positions in the layout of the items in this column, ascending
+	size_t *items;
+	size_t capacity;
+} AHMasonryColumn;
+
+struct AHLayoutMasonryIndex {
+	size_t columnCount;
+	AHMasonryColumn *columns;
+	double spacing;
+	double width;
+	double columnWidth;
+	bool packed;
+	// First item that needs placing again, AHMasonryClean when none do
+	size_t dirty;
+	size_t itemCount;
+	size_t itemCapacity;
+	// Column and row within the column of every item
+	uint32_t *column;
+	uint32_t *row;
+};
+
+static void AHMasonryFreeColumns(AHLayoutMasonryIndex *masonry) {
+	for (size_t c = 0; c < masonry->columnCount; c++) {
+		AHLayoutOffsetIndexFree(masonry->columns[c].index);
+		free(masonry->columns[c].items);
+	}
+	free(masonry->columns);
+	masonry->columns = NULL;
+	masonry->columnCount = 0;
+}
+
+void AHLayoutMasonryIndexSetColumnCount(AHLayoutMasonryIndex *masonry, size_t columnCount) {
+	if (columnCount < 1) columnCount = 1;
+	if (columnCount == masonry->columnCount) return;
+	// Keep the old columns if the new ones can't be had, a layout with no
+	// columns has nowhere to put its items
+	AHMasonryColumn *columns = calloc(columnCount, sizeof(AHMasonryColumn));
+	if (!columns) return;
+	for (size_t c = 0; c < columnCount; c++) {
+		columns[c].index = AHLayoutOffsetIndexCreate(AHLayoutOffsetIndexAxisVertical, masonry->spacing);
+		if (columns[c].index) continue;
+		while (c-- > 0) AHLayoutOffsetIndexFree(columns[c].index);
+		free(columns);
+		return;
+	}
+	AHMasonryFreeColumns(masonry);
+	masonry->columns = columns;
+	masonry->columnCount = columnCount;
+	masonry->dirty = 0;
+}
+
+AHLayoutMasonryIndex *AHLayoutMasonryIndexCreate(size_t columnCount) {
+	AHLayoutMasonryIndex *masonry = calloc(1, sizeof(AHLayoutMasonryIndex));
+	if (!masonry) return NULL;
+	AHLayoutMasonryIndexSetColumnCount(masonry, columnCount);
+	if (!masonry->columns) {
+		free(masonry);
+		return NULL;
+	}
+	return masonry;
+}
+
+void AHLayoutMasonryIndexFree(AHLayoutMasonryIndex *masonry) {
+	if (!masonry) return;
+	AHMasonryFreeColumns(masonry);
+	free(masonry->column);
+	free(masonry->row);
+	free(masonry);
+}
+
+size_t AHLayoutMasonryIndexGetColumnCount(const AHLayoutMasonryIndex *masonry) {
+	return masonry->columnCount;
+}
+
+void AHLayoutMasonryIndexInvalidate(AHLayoutMasonryIndex *masonry, size_t position) {
+	if (position < masonry->dirty) masonry->dirty = position;
+}
+
+void AHLayoutMasonryIndexItemResized(AHLayoutMasonryIndex *masonry, const AHLayoutOffsetIndex *items, size_t position) {
+	// Items waiting to be placed pick up their new size then
+	if (!masonry->packed || position >= masonry->dirty || position >= masonry->itemCount) return;
+	double width, height;
+	AHLayoutOffsetIndexGetSize(items, position, &width, &height);
+	AHMasonryColumn *column = &masonry->columns[masonry->column[position]];
+	AHLayoutOffsetIndexSetSize(column->index, masonry->row[position], masonry->columnWidth, height);
+}
+
+#pragma mark - Placing
+
+static bool AHMasonryGrowItems(AHLayoutMasonryIndex *masonry, size_t items) {
+	if (items <= masonry->itemCapacity) return true;
+	size_t capacity = masonry->itemCapacity < 64 ? 64 : masonry->itemCapacity;
+	while (capacity < items) capacity *= 2;
+	uint32_t *column = realloc(masonry->column, capacity * sizeof(uint32_t));
+	if (column) masonry->column = column;
+	uint32_t *row = realloc(masonry->row, capacity * sizeof(uint32_t));
+	if (row) masonry->row = row;
+	if (!column || !row) return false;
+	masonry->itemCapacity = capacity;
+	return true;
+}
+
+static bool AHMasonryAppend(AHMasonryColumn *column, size_t item, double width, double height) {
+	size_t count = AHLayoutOffsetIndexCount(column->index);
+	if (count == column->capacity) {
+		size_t capacity = column->capacity < 64 ? 64 : column->capacity * 2;
+		size_t *items = realloc(column->items, capacity * sizeof(size_t));
+		if (!items) return false;
+		column->items = items;
+		column->capacity = capacity;
+	}
+	if (!AHLayoutOffsetIndexInsert(column->index, count, width, height)) return false;
+	column->items[count] = item;
+	return true;
+}
+
+// Number of items in the column placed before `position`
+static size_t AHMasonryItemsBefore(const AHMasonryColumn *column, size_t position) {
+	size_t lo = 0, hi = AHLayoutOffsetIndexCount(column->index);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (column->items[mid] < position) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+bool AHLayoutMasonryIndexUpdate(AHLayoutMasonryIndex *masonry, const AHLayoutOffsetIndex *items, double width) {
+	double spacing = AHLayoutOffsetIndexGetSpacing(items);
+	size_t count = AHLayoutOffsetIndexCount(items);
+	if (!masonry->packed || spacing != masonry->spacing || width != masonry->width) {
+		masonry->dirty = 0;
+	}
+	if (count != masonry->itemCount) {
+		size_t common = count < masonry->itemCount ? count : masonry->itemCount;
+		AHLayoutMasonryIndexInvalidate(masonry, common);
+	}
+	if (masonry->dirty == AHMasonryClean) return true;
+	if (!AHMasonryGrowItems(masonry, count)) return false;
+
+	size_t columns = masonry->columnCount;
+	double columnWidth = (width - (columns + 1) * spacing) / columns;
+	if (columnWidth < 0) columnWidth = 0;
+	bool resized = masonry->dirty == 0;
+	masonry->spacing = spacing;
+	masonry->width = width;
+	masonry->columnWidth = columnWidth;
+
+	// Take every item from the first dirty one on out of its column, the
+	// columns only ever hold items in ascending order so this is their tail
+	size_t position = masonry->dirty;
+	for (size_t c = 0; c < columns; c++) {
+		AHMasonryColumn *column = &masonry->columns[c];
+		AHLayoutOffsetIndexSetSpacing(column->index, spacing);
+		if (resized) {
+			AHLayoutOffsetIndexRemoveAll(column->index);
+			continue;
+		}
+		size_t keep = AHMasonryItemsBefore(column, position);
+		for (size_t n = AHLayoutOffsetIndexCount(column->index); n > keep; n--) {
+			AHLayoutOffsetIndexRemove(column->index, n - 1);
+		}
+	}
+
+	AHLayoutItemGeometry geometry[AHMasonryChunk];
+	while (position < count) {
+		size_t copied = AHLayoutOffsetIndexCopyGeometry(items, position, count - position < AHMasonryChunk ? count - position : AHMasonryChunk, geometry);
+		if (copied == 0) break;
+		for (size_t i = 0; i < copied; i++, position++) {
+			size_t shortest = 0;
+			double shortestExtent = AHLayoutOffsetIndexContentExtent(masonry->columns[0].index);
+			for (size_t c = 1; c < columns; c++) {
+				double extent = AHLayoutOffsetIndexContentExtent(masonry->columns[c].index);
+				if (extent < shortestExtent) {
+					shortest = c;
+					shortestExtent = extent;
+				}
+			}
+			AHMasonryColumn *column = &masonry->columns[shortest];
+			masonry->column[position] = (uint32_t)shortest;
+			masonry->row[position] = (uint32_t)AHLayoutOffsetIndexCount(column->index);
+			if (!AHMasonryAppend(column, position, columnWidth, geometry[i].height)) return false;
+		}
+	}
+	masonry->itemCount = count;
+	masonry->dirty = AHMasonryClean;
+	masonry->packed = true;
+	return true;
+}
+
+#pragma mark - Queries
+
+double AHLayoutMasonryIndexContentExtent(const AHLayoutMasonryIndex *masonry) {
+	double extent = 0;
+	for (size_t c = 0; c < masonry->columnCount; c++) {
+		double columnExtent = AHLayoutOffsetIndexContentExtent(masonry->columns[c].index);
+		if (columnExtent > extent) extent = columnExtent;
+	}
+	return extent;
+}
+
+size_t AHLayoutMasonryIndexColumnOfItem(const AHLayoutMasonryIndex *masonry, size_t position) {
+	return position < masonry->itemCount ? masonry->column[position] : 0;
+}
+
+AHLayoutItemFrame AHLayoutMasonryIndexFrameOfItem(const AHLayoutMasonryIndex *masonry, size_t position) {
+	AHLayoutItemFrame frame = {0, 0, 0, 0};
+	if (position >= masonry->itemCount) return frame;
+	size_t c = masonry->column[position];
+	const AHLayoutOffsetIndex *column = masonry->columns[c].index;
+	AHLayoutItemGeometry g = AHLayoutOffsetIndexGeometryOfItem(column, masonry->row[position]);
+	// Each column lays out bottom-up from its own height, line them all
+	// up at the top of the tallest one
+	double drop = AHLayoutMasonryIndexContentExtent(masonry) - AHLayoutOffsetIndexContentExtent(column);
+	frame.x = masonry->spacing + c * (masonry->columnWidth + masonry->spacing);
+	frame.y = g.offset + drop;
+	frame.width = g.width;
+	frame.height = g.height;
+	return frame;
+}
+
+bool AHLayoutMasonryIndexItemsInExtent(const AHLayoutMasonryIndex *masonry, double start, double end, size_t *first, size_t *count) {
+	*first = 0;
+	*count = 0;
+	double extent = AHLayoutMasonryIndexContentExtent(masonry);
+	size_t low = SIZE_MAX;
+	size_t high = 0;
+	for (size_t c = 0; c < masonry->columnCount; c++) {
+		const AHMasonryColumn *column = &masonry->columns[c];
+		double drop = extent - AHLayoutOffsetIndexContentExtent(column->index);
+		size_t rowFirst, rowCount;
+		if (!AHLayoutOffsetIndexItemsInExtent(column->index, start - drop, end - drop, &rowFirst, &rowCount)) continue;
+		if (column->items[rowFirst] < low) low = column->items[rowFirst];
+		if (column->items[rowFirst + rowCount - 1] > high) high = column->items[rowFirst + rowCount - 1];
+	}
+	if (low == SIZE_MAX) return false;
+	*first = low;
+	*count = high - low + 1;
+	return true;
+}
+
+size_t AHLayoutMasonryIndexCopyItemsInExtent(const AHLayoutMasonryIndex *masonry, double start, double end, size_t *positions, size_t capacity) {
+	double extent = AHLayoutMasonryIndexContentExtent(masonry);
+	size_t total = 0;
+	for (size_t c = 0; c < masonry->columnCount; c++) {
+		const AHMasonryColumn *column = &masonry->columns[c];
+		double drop = extent - AHLayoutOffsetIndexContentExtent(column->index);
+		size_t rowFirst, rowCount;
+		if (!AHLayoutOffsetIndexItemsInExtent(column->index, start - drop, end - drop, &rowFirst, &rowCount)) continue;
+		for (size_t row = rowFirst; row < rowFirst + rowCount; row++, total++) {
+			if (total < capacity) positions[total] = column->items[row];
+		}
+	}
+	return total;
+}
+
+bool AHLayoutMasonryIndexItemAtPoint(const AHLayoutMasonryIndex *masonry, double x, double y, size_t *position) {
+	double pitch = masonry->columnWidth + masonry->spacing;
+	if (masonry->itemCount == 0 || pitch <= 0 || x < masonry->spacing) return false;
+	size_t c = (size_t)((x - masonry->spacing) / pitch);
+	if (c >= masonry->columnCount) return false;
+	const AHMasonryColumn *column = &masonry->columns[c];
+	double drop = AHLayoutMasonryIndexContentExtent(masonry) - AHLayoutOffsetIndexContentExtent(column->index);
+	size_t rowFirst, rowCount;
+	if (!AHLayoutOffsetIndexItemsInExtent(column->index, y - drop - 0.5, y - drop + 0.5, &rowFirst, &rowCount)) return false;
+	for (size_t row = rowFirst; row < rowFirst + rowCount; row++) {
+		AHLayoutItemFrame frame = AHLayoutMasonryIndexFrameOfItem(masonry, column->items[row]);
+		if (x >= frame.x && x < frame.x + frame.width && y >= frame.y && y < frame.y + frame.height) {
+			*position = column->items[row];
+			return true;
+		}
+	}
+	return false;
+}
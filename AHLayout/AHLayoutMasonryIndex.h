@@ -0,0 +1,75 @@
+//
+//  AHLayoutMasonryIndex.h
+//  AHLayout
+//
+//  Copyright (c) 2013 Airheart. All rights reserved.
+//
+
+// Places the items of an AHLayoutOffsetIndex into equal width columns for
+// AHLayoutMasonry.
+//
+// Each item goes into whichever column is shortest when it is placed and
+// keeps that column until it is placed again. Every column is an offset index
+// of its own, so the frame of an item and the items in a rect are O(log n)
+// per column. Resizing an item only moves the items below it in its column.
+// Inserting or removing an item places every item after it again.
+//
+// The heights and spacing are read from the offset index, the widths are
+// replaced by the column width.
+
+#ifndef AHLayoutMasonryIndex_h
+#define AHLayoutMasonryIndex_h
+
+#include "AHLayoutOffsetIndex.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AHLayoutMasonryIndex AHLayoutMasonryIndex;
+
+extern AHLayoutMasonryIndex *AHLayoutMasonryIndexCreate(size_t columnCount);
+extern void AHLayoutMasonryIndexFree(AHLayoutMasonryIndex *masonry);
+
+// Changing the number of columns places every item again.
+extern void AHLayoutMasonryIndexSetColumnCount(AHLayoutMasonryIndex *masonry, size_t columnCount);
+extern size_t AHLayoutMasonryIndexGetColumnCount(const AHLayoutMasonryIndex *masonry);
+
+// Marks the items from `position` on as needing to be placed again.
+// Call after inserting or removing items in the offset index.
+extern void AHLayoutMasonryIndexInvalidate(AHLayoutMasonryIndex *masonry, size_t position);
+
+// Picks up the new height of a resized item in O(log n) without moving it
+// to another column. Call after resizing the item in the offset index.
+extern void AHLayoutMasonryIndexItemResized(AHLayoutMasonryIndex *masonry, const AHLayoutOffsetIndex *items, size_t position);
+
+// Places any invalidated items. Does nothing when nothing changed, and places
+// everything again when the width or spacing did.
+extern bool AHLayoutMasonryIndexUpdate(AHLayoutMasonryIndex *masonry, const AHLayoutOffsetIndex *items, double width);
+
+// Height of the tallest column.
+extern double AHLayoutMasonryIndexContentExtent(const AHLayoutMasonryIndex *masonry);
+extern size_t AHLayoutMasonryIndexColumnOfItem(const AHLayoutMasonryIndex *masonry, size_t position);
+extern AHLayoutItemFrame AHLayoutMasonryIndexFrameOfItem(const AHLayoutMasonryIndex *masonry, size_t position);
+
+// Finds the span of items from the first to the last one overlapping
+// (start, end) vertically in any column. Columns interleave, and an item
+// next to a much shorter column can be placed long before or after its
+// neighbours, so the span can hold any number of items far from the extent.
+// Returns false if none overlap.
+extern bool AHLayoutMasonryIndexItemsInExtent(const AHLayoutMasonryIndex *masonry, double start, double end, size_t *first, size_t *count);
+
+// Copies up to `capacity` positions of the items that do overlap (start, end),
+// column by column and ascending within each, in O(log n + count) a column.
+// Returns how many overlap, which can be more than `capacity`.
+extern size_t AHLayoutMasonryIndexCopyItemsInExtent(const AHLayoutMasonryIndex *masonry, double start, double end, size_t *positions, size_t capacity);
+
+// Finds the item whose frame contains (x, y) in O(log n), searching only the
+// column under x. Returns false if the point is between items.
+extern bool AHLayoutMasonryIndexItemAtPoint(const AHLayoutMasonryIndex *masonry, double x, double y, size_t *position);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,554 @@
+//
+//  AHLayoutOffsetIndex.c
+//  AHLayout
+//
+//  Copyright (c) 2013 Airheart. All rights reserved.
+//
+
+#include "AHLayoutOffsetIndex.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Nodes live in parallel arrays indexed by node id. Id 0 is the empty
+// sentinel so that child lookups never have to branch on NULL.
+struct AHLayoutOffsetIndex {
+	AHLayoutOffsetIndexAxis axis;
+	double spacing;
+	uint32_t root;
+	uint32_t capacity;
+	uint32_t used;
+	uint32_t freeList;
+	uint32_t seed;
+	uint32_t *left;
+	uint32_t *right;
+	uint32_t *priority;
+	uint32_t *count;
+	double *width;
+	double *height;
+	double *sumWidth;
+	double *sumHeight;
+	unsigned char *flags;
+	// Room kept in front of items for section headers. Most layouts have
+	// none, so these stay NULL until the first lead is set.
+	double *lead;
+	double *sumLead;
+};
+
+#pragma mark - Nodes
+
+static uint32_t AHNextPriority(AHLayoutOffsetIndex *index) {
+	// xorshift32, plenty for balancing purposes
+	uint32_t x = index->seed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	index->seed = x;
+	return x;
+}
+
+static bool AHGrow(AHLayoutOffsetIndex *index, uint32_t capacity) {
+	if (capacity <= index->capacity) return true;
+	uint32_t *left = realloc(index->left, capacity * sizeof(uint32_t));
+	if (left) index->left = left;
+	uint32_t *right = realloc(index->right, capacity * sizeof(uint32_t));
+	if (right) index->right = right;
+	uint32_t *priority = realloc(index->priority, capacity * sizeof(uint32_t));
+	if (priority) index->priority = priority;
+	uint32_t *count = realloc(index->count, capacity * sizeof(uint32_t));
+	if (count) index->count = count;
+	double *width = realloc(index->width, capacity * sizeof(double));
+	if (width) index->width = width;
+	double *height = realloc(index->height, capacity * sizeof(double));
+	if (height) index->height = height;
+	double *sumWidth = realloc(index->sumWidth, capacity * sizeof(double));
+	if (sumWidth) index->sumWidth = sumWidth;
+	double *sumHeight = realloc(index->sumHeight, capacity * sizeof(double));
+	if (sumHeight) index->sumHeight = sumHeight;
+	unsigned char *flags = realloc(index->flags, capacity * sizeof(unsigned char));
+	if (flags) index->flags = flags;
+	if (!left || !right || !priority || !count || !width || !height || !sumWidth || !sumHeight || !flags) return false;
+	if (index->lead) {
+		double *lead = realloc(index->lead, capacity * sizeof(double));
+		if (lead) index->lead = lead;
+		double *sumLead = realloc(index->sumLead, capacity * sizeof(double));
+		if (sumLead) index->sumLead = sumLead;
+		if (!lead || !sumLead) return false;
+	}
+	index->capacity = capacity;
+	return true;
+}
+
+static uint32_t AHAllocNode(AHLayoutOffsetIndex *index, double width, double height) {
+	uint32_t node = index->freeList;
+	if (node) {
+		index->freeList = index->left[node];
+	} else {
+		if (index->used == index->capacity) {
+			uint32_t capacity = index->capacity < 64 ? 64 : index->capacity * 2;
+			if (!AHGrow(index, capacity)) return 0;
+		}
+		node = index->used++;
+	}
+	index->left[node] = 0;
+	index->right[node] = 0;
+	index->priority[node] = AHNextPriority(index);
+	index->count[node] = 1;
+	index->width[node] = width;
+	index->height[node] = height;
+	index->sumWidth[node] = width;
+	index->sumHeight[node] = height;
+	index->flags[node] = 0;
+	if (index->lead) index->lead[node] = index->sumLead[node] = 0;
+	return node;
+}
+
+static void AHFreeNode(AHLayoutOffsetIndex *index, uint32_t node) {
+	index->left[node] = index->freeList;
+	index->freeList = node;
+}
+
+static inline void AHUpdate(AHLayoutOffsetIndex *index, uint32_t node) {
+	uint32_t l = index->left[node];
+	uint32_t r = index->right[node];
+	index->count[node] = index->count[l] + index->count[r] + 1;
+	index->sumWidth[node] = index->sumWidth[l] + index->sumWidth[r] + index->width[node];
+	index->sumHeight[node] = index->sumHeight[l] + index->sumHeight[r] + index->height[node];
+	if (index->lead) index->sumLead[node] = index->sumLead[l] + index->sumLead[r] + index->lead[node];
+}
+
+static inline double AHLead(const AHLayoutOffsetIndex *index, uint32_t node) {
+	return index->lead ? index->lead[node] : 0;
+}
+
+// Main-axis extent of an item including its lead
+static inline double AHMain(const AHLayoutOffsetIndex *index, uint32_t node) {
+	double main = index->axis == AHLayoutOffsetIndexAxisVertical ? index->height[node] : index->width[node];
+	return main + AHLead(index, node);
+}
+
+static inline double AHSumMain(const AHLayoutOffsetIndex *index, uint32_t node) {
+	double sum = index->axis == AHLayoutOffsetIndexAxisVertical ? index->sumHeight[node] : index->sumWidth[node];
+	return index->lead ? sum + index->sumLead[node] : sum;
+}
+
+// Splits `node` into the first `k` items and the rest
+static void AHSplit(AHLayoutOffsetIndex *index, uint32_t node, size_t k, uint32_t *l, uint32_t *r) {
+	if (!node) {
+		*l = *r = 0;
+		return;
+	}
+	size_t leftCount = index->count[index->left[node]];
+	if (k <= leftCount) {
+		uint32_t newLeft;
+		AHSplit(index, index->left[node], k, l, &newLeft);
+		index->left[node] = newLeft;
+		*r = node;
+	} else {
+		uint32_t newRight;
+		AHSplit(index, index->right[node], k - leftCount - 1, &newRight, r);
+		index->right[node] = newRight;
+		*l = node;
+	}
+	AHUpdate(index, node);
+}
+
+static uint32_t AHMerge(AHLayoutOffsetIndex *index, uint32_t a, uint32_t b) {
+	if (!a) return b;
+	if (!b) return a;
+	if (index->priority[a] > index->priority[b]) {
+		index->right[a] = AHMerge(index, index->right[a], b);
+		AHUpdate(index, a);
+		return a;
+	}
+	index->left[b] = AHMerge(index, a, index->left[b]);
+	AHUpdate(index, b);
+	return b;
+}
+
+static uint32_t AHNodeAtPosition(const AHLayoutOffsetIndex *index, size_t position) {
+	uint32_t node = index->root;
+	while (node) {
+		size_t leftCount = index->count[index->left[node]];
+		if (position < leftCount) {
+			node = index->left[node];
+		} else if (position == leftCount) {
+			return node;
+		} else {
+			position -= leftCount + 1;
+			node = index->right[node];
+		}
+	}
+	return 0;
+}
+
+static void AHSetSize(AHLayoutOffsetIndex *index, uint32_t node, size_t position, double width, double height) {
+	size_t leftCount = index->count[index->left[node]];
+	if (position < leftCount) {
+		AHSetSize(index, index->left[node], position, width, height);
+	} else if (position == leftCount) {
+		index->width[node] = width;
+		index->height[node] = height;
+	} else {
+		AHSetSize(index, index->right[node], position - leftCount - 1, width, height);
+	}
+	AHUpdate(index, node);
+}
+
+static void AHSetLead(AHLayoutOffsetIndex *index, uint32_t node, size_t position, double lead) {
+	size_t leftCount = index->count[index->left[node]];
+	if (position < leftCount) {
+		AHSetLead(index, index->left[node], position, lead);
+	} else if (position == leftCount) {
+		index->lead[node] = lead;
+	} else {
+		AHSetLead(index, index->right[node], position - leftCount - 1, lead);
+	}
+	AHUpdate(index, node);
+}
+
+#pragma mark - Lifecycle
+
+AHLayoutOffsetIndex *AHLayoutOffsetIndexCreate(AHLayoutOffsetIndexAxis axis, double spacing) {
+	AHLayoutOffsetIndex *index = calloc(1, sizeof(AHLayoutOffsetIndex));
+	if (!index) return NULL;
+	index->axis = axis;
+	index->spacing = spacing;
+	index->seed = 2463534242u;
+	if (!AHGrow(index, 64)) {
+		AHLayoutOffsetIndexFree(index);
+		return NULL;
+	}
+	AHLayoutOffsetIndexRemoveAll(index);
+	return index;
+}
+
+void AHLayoutOffsetIndexFree(AHLayoutOffsetIndex *index) {
+	if (!index) return;
+	free(index->left);
+	free(index->right);
+	free(index->priority);
+	free(index->count);
+	free(index->width);
+	free(index->height);
+	free(index->sumWidth);
+	free(index->sumHeight);
+	free(index->flags);
+	free(index->lead);
+	free(index->sumLead);
+	free(index);
+}
+
+void AHLayoutOffsetIndexSetAxis(AHLayoutOffsetIndex *index, AHLayoutOffsetIndexAxis axis) {
+	index->axis = axis;
+}
+
+AHLayoutOffsetIndexAxis AHLayoutOffsetIndexGetAxis(const AHLayoutOffsetIndex *index) {
+	return index->axis;
+}
+
+void AHLayoutOffsetIndexSetSpacing(AHLayoutOffsetIndex *index, double spacing) {
+	index->spacing = spacing;
+}
+
+double AHLayoutOffsetIndexGetSpacing(const AHLayoutOffsetIndex *index) {
+	return index->spacing;
+}
+
+size_t AHLayoutOffsetIndexCount(const AHLayoutOffsetIndex *index) {
+	return index->count[index->root];
+}
+
+void AHLayoutOffsetIndexRemoveAll(AHLayoutOffsetIndex *index) {
+	// the sentinel
+	index->left[0] = index->right[0] = 0;
+	index->priority[0] = 0;
+	index->count[0] = 0;
+	index->width[0] = index->height[0] = 0;
+	index->sumWidth[0] = index->sumHeight[0] = 0;
+	index->flags[0] = 0;
+	if (index->lead) index->lead[0] = index->sumLead[0] = 0;
+	index->root = 0;
+	index->used = 1;
+	index->freeList = 0;
+}
+
+// Builds a treap of `count` new items in order and returns its root, 0 for
+// none or when out of memory. Works left to right in O(n) by keeping the right
+// spine on a stack. A node's subtree is final once it is popped, so sums are
+// filled in then.
+static uint32_t AHBuildTree(AHLayoutOffsetIndex *index, size_t count, const double *widths, const double *heights, double width, double height, unsigned char flags) {
+	if (count == 0) return 0;
+	if (count >= UINT32_MAX - 1 - index->used || !AHGrow(index, index->used + (uint32_t)count)) return 0;
+	uint32_t *spine = malloc(count * sizeof(uint32_t));
+	if (!spine) return 0;
+	size_t depth = 0;
+	for (size_t i = 0; i < count; i++) {
+		uint32_t node = AHAllocNode(index, widths ? widths[i] : width, heights ? heights[i] : height);
+		index->flags[node] = flags;
+		uint32_t last = 0;
+		while (depth > 0 && index->priority[spine[depth - 1]] < index->priority[node]) {
+			last = spine[--depth];
+			AHUpdate(index, last);
+		}
+		index->left[node] = last;
+		if (depth > 0) index->right[spine[depth - 1]] = node;
+		spine[depth++] = node;
+	}
+	while (depth > 0) {
+		AHUpdate(index, spine[--depth]);
+	}
+	uint32_t root = spine[0];
+	free(spine);
+	return root;
+}
+
+static bool AHBuild(AHLayoutOffsetIndex *index, size_t count, const double *widths, const double *heights, double width, double height) {
+	AHLayoutOffsetIndexRemoveAll(index);
+	if (count == 0) return true;
+	index->root = AHBuildTree(index, count, widths, heights, width, height, 0);
+	return index->root != 0;
+}
+
+bool AHLayoutOffsetIndexReset(AHLayoutOffsetIndex *index, size_t count, const double *widths, const double *heights) {
+	return AHBuild(index, count, widths, heights, 0, 0);
+}
+
+bool AHLayoutOffsetIndexResetUniform(AHLayoutOffsetIndex *index, size_t count, double width, double height) {
+	return AHBuild(index, count, NULL, NULL, width, height);
+}
+
+#pragma mark - Editing
+
+bool AHLayoutOffsetIndexInsert(AHLayoutOffsetIndex *index, size_t position, double width, double height) {
+	size_t count = AHLayoutOffsetIndexCount(index);
+	if (position > count) position = count;
+	uint32_t node = AHAllocNode(index, width, height);
+	if (!node) return false;
+	uint32_t l, r;
+	AHSplit(index, index->root, position, &l, &r);
+	index->root = AHMerge(index, AHMerge(index, l, node), r);
+	return true;
+}
+
+void AHLayoutOffsetIndexRemove(AHLayoutOffsetIndex *index, size_t position) {
+	if (position >= AHLayoutOffsetIndexCount(index)) return;
+	uint32_t l, m, r;
+	AHSplit(index, index->root, position, &l, &m);
+	AHSplit(index, m, 1, &m, &r);
+	AHFreeNode(index, m);
+	index->root = AHMerge(index, l, r);
+}
+
+bool AHLayoutOffsetIndexInsertRange(AHLayoutOffsetIndex *index, size_t position, size_t count, const double *widths, const double *heights, unsigned char flags) {
+	if (count == 0) return true;
+	size_t total = AHLayoutOffsetIndexCount(index);
+	if (position > total) position = total;
+	uint32_t run = AHBuildTree(index, count, widths, heights, 0, 0, flags);
+	if (!run) return false;
+	uint32_t l, r;
+	AHSplit(index, index->root, position, &l, &r);
+	index->root = AHMerge(index, AHMerge(index, l, run), r);
+	return true;
+}
+
+void AHLayoutOffsetIndexRemoveRange(AHLayoutOffsetIndex *index, size_t position, size_t count) {
+	size_t total = AHLayoutOffsetIndexCount(index);
+	if (position >= total || count == 0) return;
+	if (count > total - position) count = total - position;
+	uint32_t l, m, r;
+	AHSplit(index, index->root, position, &l, &m);
+	AHSplit(index, m, count, &m, &r);
+	index->root = AHMerge(index, l, r);
+	// Freeing a node reuses its left link, so left children are rotated up
+	// until the node has none. Each rotation moves a node off the left spine
+	// for good, so this is O(count) with no allocation that could fail.
+	while (m) {
+		uint32_t left = index->left[m];
+		if (left) {
+			index->left[m] = index->right[left];
+			index->right[left] = m;
+			m = left;
+		} else {
+			uint32_t right = index->right[m];
+			AHFreeNode(index, m);
+			m = right;
+		}
+	}
+}
+
+void AHLayoutOffsetIndexSetSize(AHLayoutOffsetIndex *index, size_t position, double width, double height) {
+	if (position >= AHLayoutOffsetIndexCount(index)) return;
+	AHSetSize(index, index->root, position, width, height);
+}
+
+void AHLayoutOffsetIndexGetSize(const AHLayoutOffsetIndex *index, size_t position, double *width, double *height) {
+	uint32_t node = AHNodeAtPosition(index, position);
+	if (width) *width = index->width[node];
+	if (height) *height = index->height[node];
+}
+
+unsigned char AHLayoutOffsetIndexGetFlags(const AHLayoutOffsetIndex *index, size_t position) {
+	return index->flags[AHNodeAtPosition(index, position)];
+}
+
+void AHLayoutOffsetIndexSetFlags(AHLayoutOffsetIndex *index, size_t position, unsigned char flags) {
+	uint32_t node = AHNodeAtPosition(index, position);
+	if (node) index->flags[node] = flags;
+}
+
+void AHLayoutOffsetIndexSetLead(AHLayoutOffsetIndex *index, size_t position, double lead) {
+	if (position >= AHLayoutOffsetIndexCount(index)) return;
+	if (!index->lead) {
+		if (lead == 0) return;
+		// Every existing lead is zero, so zeroed arrays are already consistent
+		index->lead = calloc(index->capacity, sizeof(double));
+		index->sumLead = calloc(index->capacity, sizeof(double));
+		if (!index->lead || !index->sumLead) {
+			free(index->lead);
+			free(index->sumLead);
+			index->lead = index->sumLead = NULL;
+			return;
+		}
+	}
+	AHSetLead(index, index->root, position, lead);
+}
+
+double AHLayoutOffsetIndexGetLead(const AHLayoutOffsetIndex *index, size_t position) {
+	return AHLead(index, AHNodeAtPosition(index, position));
+}
+
+#pragma mark - Queries
+
+double AHLayoutOffsetIndexPrefixExtent(const AHLayoutOffsetIndex *index, size_t position) {
+	double sum = 0;
+	uint32_t node = index->root;
+	while (node) {
+		uint32_t left = index->left[node];
+		size_t leftCount = index->count[left];
+		if (position <= leftCount) {
+			node = left;
+		} else {
+			sum += AHSumMain(index, left) + AHMain(index, node);
+			position -= leftCount + 1;
+			node = index->right[node];
+		}
+	}
+	return sum;
+}
+
+double AHLayoutOffsetIndexContentExtent(const AHLayoutOffsetIndex *index) {
+	return AHSumMain(index, index->root) + AHLayoutOffsetIndexCount(index) * index->spacing;
+}
+
+// Vertical layouts are laid out bottom-up from the content height, horizontal
+// ones left-to-right with a leading spacing, as AHLayout always has.
+// Items sit at the far end of their lead, below it when vertical and to the
+// right of it when horizontal.
+static inline double AHOffset(const AHLayoutOffsetIndex *index, double contentExtent, double prefix, double main, double lead, size_t position) {
+	if (index->axis == AHLayoutOffsetIndexAxisVertical) {
+		return contentExtent - prefix - main - position * index->spacing;
+	}
+	return index->spacing + prefix + lead + position * index->spacing;
+}
+
+double AHLayoutOffsetIndexOffsetOfItem(const AHLayoutOffsetIndex *index, size_t position) {
+	return AHLayoutOffsetIndexGeometryOfItem(index, position).offset;
+}
+
+AHLayoutItemGeometry AHLayoutOffsetIndexGeometryOfItem(const AHLayoutOffsetIndex *index, size_t position) {
+	AHLayoutItemGeometry geometry = {0, 0, 0};
+	AHLayoutOffsetIndexCopyGeometry(index, position, 1, &geometry);
+	return geometry;
+}
+
+typedef struct {
+	const AHLayoutOffsetIndex *index;
+	double contentExtent;
+	size_t start;
+	size_t end;
+	AHLayoutItemGeometry *geometry;
+} AHCopyContext;
+
+static void AHCopy(AHCopyContext *ctx, uint32_t node, size_t first, double prefixBefore) {
+	if (!node) return;
+	const AHLayoutOffsetIndex *index = ctx->index;
+	uint32_t left = index->left[node];
+	size_t position = first + index->count[left];
+	double prefix = prefixBefore + AHSumMain(index, left);
+	if (ctx->start < position) {
+		AHCopy(ctx, left, first, prefixBefore);
+	}
+	if (position >= ctx->end) return;
+	if (position >= ctx->start) {
+		AHLayoutItemGeometry *g = &ctx->geometry[position - ctx->start];
+		g->width = index->width[node];
+		g->height = index->height[node];
+		g->offset = AHOffset(index, ctx->contentExtent, prefix, AHMain(index, node), AHLead(index, node), position);
+	}
+	if (ctx->end > position + 1) {
+		AHCopy(ctx, index->right[node], position + 1, prefix + AHMain(index, node));
+	}
+}
+
+size_t AHLayoutOffsetIndexCopyGeometry(const AHLayoutOffsetIndex *index, size_t position, size_t count, AHLayoutItemGeometry *geometry) {
+	size_t total = AHLayoutOffsetIndexCount(index);
+	if (position >= total || count == 0) return 0;
+	if (count > total - position) count = total - position;
+	AHCopyContext ctx = {index, AHLayoutOffsetIndexContentExtent(index), position, position + count, geometry};
+	AHCopy(&ctx, index->root, 0, 0);
+	return count;
+}
+
+// Smallest position p whose running extent Q(p + 1), every item counted
+// with its trailing spacing, exceeds `value` (or reaches it when `inclusive`).
+// Returns the item count if there is no such position.
+static size_t AHFirstPositionReaching(const AHLayoutOffsetIndex *index, double value, bool inclusive) {
+	size_t position = 0;
+	uint32_t node = index->root;
+	while (node) {
+		uint32_t left = index->left[node];
+		double leftExtent = AHSumMain(index, left) + index->count[left] * index->spacing;
+		if (inclusive ? value <= leftExtent : value < leftExtent) {
+			node = left;
+			continue;
+		}
+		value -= leftExtent;
+		position += index->count[left];
+		double extent = AHMain(index, node) + index->spacing;
+		if (inclusive ? value <= extent : value < extent) {
+			return position;
+		}
+		value -= extent;
+		position += 1;
+		node = index->right[node];
+	}
+	return position;
+}
+
+bool AHLayoutOffsetIndexItemsInExtent(const AHLayoutOffsetIndex *index, double start, double end, size_t *first, size_t *count) {
+	*first = 0;
+	*count = 0;
+	size_t total = AHLayoutOffsetIndexCount(index);
+	if (total == 0 || end <= start) return false;
+
+	size_t lo, hi;
+	if (index->axis == AHLayoutOffsetIndexAxisVertical) {
+		// item i spans (C - Q(i + 1) + spacing, C - Q(i)), later items are lower
+		double content = AHLayoutOffsetIndexContentExtent(index);
+		if (content - start <= 0) return false;
+		lo = AHFirstPositionReaching(index, content - end + index->spacing, false);
+		hi = AHFirstPositionReaching(index, content - start, true);
+	} else {
+		// item i spans (Q(i) + spacing, Q(i + 1))
+		if (end - index->spacing <= 0) return false;
+		lo = AHFirstPositionReaching(index, start, false);
+		hi = AHFirstPositionReaching(index, end - index->spacing, true);
+	}
+	if (hi >= total) hi = total - 1;
+	if (lo > hi) return false;
+	*first = lo;
+	*count = hi - lo + 1;
+	return true;
+}
@@ -0,0 +1,122 @@
+//
+//  AHLayoutOffsetIndex.h
+//  AHLayout
+//
+//  Copyright (c) 2013 Airheart. All rights reserved.
+//
+
+// A prefix-sum index over the sizes of the items in an AHLayout.
+//
+// Items are kept in an implicit balanced tree (a treap ordered by item
+// position) where every node carries the summed width and height of its
+// subtree. That lets the layout ask for the offset of any item, the total
+// content extent, or change the size of, insert or remove an item in
+// O(log n) instead of walking every item.
+//
+// This is also the only per-item storage AHLayout has. Nodes live in
+// parallel arrays (links, counts, sizes, sums and a flag byte), about
+// 50 bytes an item, rather than one heap object per item.
+//
+// This file is plain C with no AppKit dependency so that it can be compiled
+// and benchmarked on its own (see Benchmarks/).
+
+#ifndef AHLayoutOffsetIndex_h
+#define AHLayoutOffsetIndex_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+	// Items stack bottom-up: item 0 sits at the top of the content and
+	// the last item ends at y = 0.
+	AHLayoutOffsetIndexAxisVertical,
+	// Items stack left-to-right starting at x = spacing.
+	AHLayoutOffsetIndexAxisHorizontal,
+} AHLayoutOffsetIndexAxis;
+
+typedef struct AHLayoutOffsetIndex AHLayoutOffsetIndex;
+
+// Geometry of a single item along with its main-axis offset
+// (y for vertical layouts, x for horizontal ones).
+typedef struct {
+	double offset;
+	double width;
+	double height;
+} AHLayoutItemGeometry;
+
+// Full frame of an item, for layouts that place items on both axes.
+typedef struct {
+	double x;
+	double y;
+	double width;
+	double height;
+} AHLayoutItemFrame;
+
+extern AHLayoutOffsetIndex *AHLayoutOffsetIndexCreate(AHLayoutOffsetIndexAxis axis, double spacing);
+extern void AHLayoutOffsetIndexFree(AHLayoutOffsetIndex *index);
+
+// Changing the axis or spacing is O(1), both sums are always maintained.
+extern void AHLayoutOffsetIndexSetAxis(AHLayoutOffsetIndex *index, AHLayoutOffsetIndexAxis axis);
+extern AHLayoutOffsetIndexAxis AHLayoutOffsetIndexGetAxis(const AHLayoutOffsetIndex *index);
+extern void AHLayoutOffsetIndexSetSpacing(AHLayoutOffsetIndex *index, double spacing);
+extern double AHLayoutOffsetIndexGetSpacing(const AHLayoutOffsetIndex *index);
+
+extern size_t AHLayoutOffsetIndexCount(const AHLayoutOffsetIndex *index);
+
+// Replaces the contents of the index with `count` items in O(n).
+// `widths` and `heights` may be NULL, in which case the items are zero sized.
+extern bool AHLayoutOffsetIndexReset(AHLayoutOffsetIndex *index, size_t count, const double *widths, const double *heights);
+// Same as above with every item given the same size, no arrays needed.
+extern bool AHLayoutOffsetIndexResetUniform(AHLayoutOffsetIndex *index, size_t count, double width, double height);
+extern void AHLayoutOffsetIndexRemoveAll(AHLayoutOffsetIndex *index);
+
+// O(log n) edits. `position` may equal the count for insertion.
+extern bool AHLayoutOffsetIndexInsert(AHLayoutOffsetIndex *index, size_t position, double width, double height);
+extern void AHLayoutOffsetIndexRemove(AHLayoutOffsetIndex *index, size_t position);
+// A run of `count` items inserted or removed at once in O(count + log n),
+// rather than O(count log n) one at a time. `widths` and `heights` may be
+// NULL, and every inserted item starts out with `flags`.
+extern bool AHLayoutOffsetIndexInsertRange(AHLayoutOffsetIndex *index, size_t position, size_t count, const double *widths, const double *heights, unsigned char flags);
+extern void AHLayoutOffsetIndexRemoveRange(AHLayoutOffsetIndex *index, size_t position, size_t count);
+extern void AHLayoutOffsetIndexSetSize(AHLayoutOffsetIndex *index, size_t position, double width, double height);
+extern void AHLayoutOffsetIndexGetSize(const AHLayoutOffsetIndex *index, size_t position, double *width, double *height);
+
+// Eight bits of per-item state for the caller, they move with the item on
+// insertion and removal. New items start with no flags set.
+extern unsigned char AHLayoutOffsetIndexGetFlags(const AHLayoutOffsetIndex *index, size_t position);
+extern void AHLayoutOffsetIndexSetFlags(AHLayoutOffsetIndex *index, size_t position, unsigned char flags);
+// Extra main-axis room kept in front of an item, used for section headers.
+// It counts towards the content extent, prefix extents and ItemsInExtent,
+// but not towards the item's own size or geometry. Vertical items sit below
+// their lead, horizontal ones to the right of it. The lead moves with the item.
+extern void AHLayoutOffsetIndexSetLead(AHLayoutOffsetIndex *index, size_t position, double lead);
+extern double AHLayoutOffsetIndexGetLead(const AHLayoutOffsetIndex *index, size_t position);
+
+// Sum of the main-axis sizes and leads of the items in [0, position), spacing excluded.
+extern double AHLayoutOffsetIndexPrefixExtent(const AHLayoutOffsetIndex *index, size_t position);
+
+// Main-axis length of the content, including one spacing per item,
+// which matches what AHLayout has always reported as its content size.
+extern double AHLayoutOffsetIndexContentExtent(const AHLayoutOffsetIndex *index);
+
+// Main-axis origin of the item at `position`.
+extern double AHLayoutOffsetIndexOffsetOfItem(const AHLayoutOffsetIndex *index, size_t position);
+extern AHLayoutItemGeometry AHLayoutOffsetIndexGeometryOfItem(const AHLayoutOffsetIndex *index, size_t position);
+
+// Copies the geometry of up to `count` items starting at `position` into
+// `geometry` in O(log n + count). Returns the number of items copied.
+extern size_t AHLayoutOffsetIndexCopyGeometry(const AHLayoutOffsetIndex *index, size_t position, size_t count, AHLayoutItemGeometry *geometry);
+
+// Finds the contiguous run of items whose main-axis span overlaps
+// (start, end) in O(log n). Returns false and a zero count if none do.
+extern bool AHLayoutOffsetIndexItemsInExtent(const AHLayoutOffsetIndex *index, double start, double end, size_t *first, size_t *count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
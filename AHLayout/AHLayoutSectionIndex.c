@@ -0,0 +1,130 @@
+//
+//  AHLayoutSectionIndex.c
+//  AHLayout
+//
+//  Copyright (c) 2013 Airheart. All rights reserved.
+//
+
+#include "AHLayoutSectionIndex.h"
+
+#include <stdlib.h>
+
+struct AHLayoutSectionIndex {
+	size_t count;
+	size_t capacity;
+	size_t itemCount;
+	// First item of every section
+	size_t *start;
+	double *headerExtent;
+};
+
+AHLayoutSectionIndex *AHLayoutSectionIndexCreate(void) {
+	return calloc(1, sizeof(AHLayoutSectionIndex));
+}
+
+void AHLayoutSectionIndexFree(AHLayoutSectionIndex *sections) {
+	if (!sections) return;
+	free(sections->start);
+	free(sections->headerExtent);
+	free(sections);
+}
+
+bool AHLayoutSectionIndexReset(AHLayoutSectionIndex *sections, size_t sectionCount, const size_t *itemCounts) {
+	if (sectionCount > sections->capacity) {
+		size_t *start = realloc(sections->start, sectionCount * sizeof(size_t));
+		if (start) sections->start = start;
+		double *headerExtent = realloc(sections->headerExtent, sectionCount * sizeof(double));
+		if (headerExtent) sections->headerExtent = headerExtent;
+		if (!start || !headerExtent) return false;
+		sections->capacity = sectionCount;
+	}
+	size_t item = 0;
+	for (size_t i = 0; i < sectionCount; i++) {
+		sections->start[i] = item;
+		sections->headerExtent[i] = 0;
+		item += itemCounts[i];
+	}
+	sections->count = sectionCount;
+	sections->itemCount = item;
+	return true;
+}
+
+size_t AHLayoutSectionIndexCount(const AHLayoutSectionIndex *sections) {
+	return sections->count;
+}
+
+size_t AHLayoutSectionIndexItemCount(const AHLayoutSectionIndex *sections) {
+	return sections->itemCount;
+}
+
+void AHLayoutSectionIndexSetHeaderExtent(AHLayoutSectionIndex *sections, size_t section, double extent) {
+	if (section < sections->count) sections->headerExtent[section] = extent;
+}
+
+double AHLayoutSectionIndexGetHeaderExtent(const AHLayoutSectionIndex *sections, size_t section) {
+	return section < sections->count ? sections->headerExtent[section] : 0;
+}
+
+size_t AHLayoutSectionIndexSectionOfItem(const AHLayoutSectionIndex *sections, size_t item) {
+	if (sections->count == 0) return 0;
+	// Last section starting at or before the item
+	size_t lo = 0, hi = sections->count - 1;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo + 1) / 2;
+		if (sections->start[mid] <= item) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return lo;
+}
+
+size_t AHLayoutSectionIndexFirstItem(const AHLayoutSectionIndex *sections, size_t section) {
+	return section < sections->count ? sections->start[section] : sections->itemCount;
+}
+
+size_t AHLayoutSectionIndexItemCountInSection(const AHLayoutSectionIndex *sections, size_t section) {
+	if (section >= sections->count) return 0;
+	return AHLayoutSectionIndexFirstItem(sections, section + 1) - sections->start[section];
+}
+
+void AHLayoutSectionIndexInsertItem(AHLayoutSectionIndex *sections, size_t item) {
+	if (sections->count == 0) return;
+	size_t section = item < sections->itemCount ? AHLayoutSectionIndexSectionOfItem(sections, item) : sections->count - 1;
+	for (size_t i = section + 1; i < sections->count; i++) {
+		sections->start[i]++;
+	}
+	sections->itemCount++;
+}
+
+void AHLayoutSectionIndexRemoveItem(AHLayoutSectionIndex *sections, size_t item) {
+	if (sections->count == 0 || item >= sections->itemCount) return;
+	size_t section = AHLayoutSectionIndexSectionOfItem(sections, item);
+	for (size_t i = section + 1; i < sections->count; i++) {
+		sections->start[i]--;
+	}
+	sections->itemCount--;
+}
+
+double AHLayoutSectionIndexLeadOfItem(const AHLayoutSectionIndex *sections, size_t item, double spacing) {
+	if (item >= sections->itemCount || sections->count == 0) return 0;
+	double lead = 0;
+	// Walk back over the sections starting at this item
+	for (size_t section = AHLayoutSectionIndexSectionOfItem(sections, item) + 1; section-- > 0;) {
+		if (sections->start[section] != item) break;
+		if (sections->headerExtent[section] > 0) lead += sections->headerExtent[section] + spacing;
+	}
+	return lead;
+}
+
+double AHLayoutSectionIndexHeaderOffsetInLead(const AHLayoutSectionIndex *sections, size_t section, double spacing) {
+	if (section >= sections->count) return 0;
+	size_t item = sections->start[section];
+	double offset = 0;
+	for (size_t i = section; i-- > 0;) {
+		if (sections->start[i] != item) break;
+		if (sections->headerExtent[i] > 0) offset += sections->headerExtent[i] + spacing;
+	}
+	return offset;
+}
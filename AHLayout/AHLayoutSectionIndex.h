@@ -0,0 +1,66 @@
+//
+//  AHLayoutSectionIndex.h
+//  AHLayout
+//
+//  Copyright (c) 2013 Airheart. All rights reserved.
+//
+
+// Splits the items of an AHLayout into consecutive sections.
+//
+// Sections are kept as the position of their first item, an ascending
+// prefix of the section item counts, so the section of an item is a binary
+// search. Inserting or removing an item moves the start of every later
+// section, which is O(sections) and sections are few.
+//
+// Each section also keeps the main-axis extent of its header. Headers take
+// room in front of the first item of their section through the offset index
+// leads, see AHLayoutSectionIndexLeadOfItem.
+
+#ifndef AHLayoutSectionIndex_h
+#define AHLayoutSectionIndex_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AHLayoutSectionIndex AHLayoutSectionIndex;
+
+extern AHLayoutSectionIndex *AHLayoutSectionIndexCreate(void);
+extern void AHLayoutSectionIndexFree(AHLayoutSectionIndex *sections);
+
+// Replaces every section. Header extents start out at zero.
+extern bool AHLayoutSectionIndexReset(AHLayoutSectionIndex *sections, size_t sectionCount, const size_t *itemCounts);
+extern size_t AHLayoutSectionIndexCount(const AHLayoutSectionIndex *sections);
+extern size_t AHLayoutSectionIndexItemCount(const AHLayoutSectionIndex *sections);
+
+extern void AHLayoutSectionIndexSetHeaderExtent(AHLayoutSectionIndex *sections, size_t section, double extent);
+extern double AHLayoutSectionIndexGetHeaderExtent(const AHLayoutSectionIndex *sections, size_t section);
+
+// The section holding the item. Empty sections hold no items, so this is
+// never one of them unless every section is empty.
+extern size_t AHLayoutSectionIndexSectionOfItem(const AHLayoutSectionIndex *sections, size_t item);
+extern size_t AHLayoutSectionIndexFirstItem(const AHLayoutSectionIndex *sections, size_t section);
+extern size_t AHLayoutSectionIndexItemCountInSection(const AHLayoutSectionIndex *sections, size_t section);
+
+// An item inserted at `item` joins the section of the item it displaces,
+// or the last section when appended.
+extern void AHLayoutSectionIndexInsertItem(AHLayoutSectionIndex *sections, size_t item);
+extern void AHLayoutSectionIndexRemoveItem(AHLayoutSectionIndex *sections, size_t item);
+
+// Room needed in front of the item for the headers of the sections starting
+// at it, each header followed by `spacing`. Only non-zero for the first item
+// of a section, or of a run of empty sections followed by one with items.
+extern double AHLayoutSectionIndexLeadOfItem(const AHLayoutSectionIndex *sections, size_t item, double spacing);
+
+// Distance from the start of its item's lead to the header of `section`.
+// Headers of empty sections stack in front of the next section's header.
+extern double AHLayoutSectionIndexHeaderOffsetInLead(const AHLayoutSectionIndex *sections, size_t section, double spacing);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,215 @@
+//
+//  AHLayoutSizeCache.c
+//  AHLayout
+//
+//  Copyright (c) 2013 Airheart. All rights reserved.
+//
+
+// ftruncate and msync are POSIX, not C99
+#define _XOPEN_SOURCE 600
+
+#include "AHLayoutSizeCache.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define kAHLayoutSizeCacheMagic 0x43534841 // "AHSC"
+#define kAHLayoutSizeCacheVersion 1
+#define kAHLayoutSizeCacheInitialCapacity 1024
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t capacity;
+	uint64_t count;
+	uint64_t reserved;
+} AHLayoutSizeCacheHeader;
+
+// Sizes in points fit a float exactly enough, which keeps entries at 24 bytes
+typedef struct {
+	uint64_t key;
+	float crossExtent;
+	float width;
+	float height;
+	uint32_t used;
+} AHLayoutSizeCacheEntry;
+
+struct AHLayoutSizeCache {
+	int fd;
+	size_t maximumCount;
+	size_t length;
+	AHLayoutSizeCacheHeader *header;
+	AHLayoutSizeCacheEntry *entries;
+};
+
+#pragma mark - Mapping
+
+static size_t AHLengthForCapacity(uint64_t capacity) {
+	return sizeof(AHLayoutSizeCacheHeader) + capacity * sizeof(AHLayoutSizeCacheEntry);
+}
+
+static void AHUnmap(AHLayoutSizeCache *cache) {
+	if (cache->header) munmap(cache->header, cache->length);
+	cache->header = NULL;
+	cache->entries = NULL;
+	cache->length = 0;
+}
+
+static bool AHMap(AHLayoutSizeCache *cache, size_t length) {
+	void *bytes = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+	if (bytes == MAP_FAILED) return false;
+	cache->length = length;
+	cache->header = bytes;
+	cache->entries = (AHLayoutSizeCacheEntry *)((char *)bytes + sizeof(AHLayoutSizeCacheHeader));
+	return true;
+}
+
+// Replaces the file with an empty table. Truncating first zeroes the entries.
+static bool AHReset(AHLayoutSizeCache *cache, uint64_t capacity) {
+	AHUnmap(cache);
+	size_t length = AHLengthForCapacity(capacity);
+	if (ftruncate(cache->fd, 0) != 0 || ftruncate(cache->fd, length) != 0) return false;
+	if (!AHMap(cache, length)) return false;
+	cache->header->magic = kAHLayoutSizeCacheMagic;
+	cache->header->version = kAHLayoutSizeCacheVersion;
+	cache->header->capacity = capacity;
+	cache->header->count = 0;
+	return true;
+}
+
+AHLayoutSizeCache *AHLayoutSizeCacheOpen(const char *path, size_t maximumCount) {
+	AHLayoutSizeCache *cache = calloc(1, sizeof(AHLayoutSizeCache));
+	if (!cache) return NULL;
+	cache->maximumCount = maximumCount > 0 ? maximumCount : 1;
+	cache->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (cache->fd < 0) {
+		free(cache);
+		return NULL;
+	}
+	struct stat info;
+	bool valid = false;
+	if (fstat(cache->fd, &info) == 0 && (size_t)info.st_size >= sizeof(AHLayoutSizeCacheHeader) && AHMap(cache, info.st_size)) {
+		AHLayoutSizeCacheHeader *header = cache->header;
+		uint64_t capacity = header->capacity;
+		valid = header->magic == kAHLayoutSizeCacheMagic && header->version == kAHLayoutSizeCacheVersion &&
+			capacity > 0 && (capacity & (capacity - 1)) == 0 && header->count < capacity &&
+			AHLengthForCapacity(capacity) == (size_t)info.st_size;
+	}
+	if (!valid && !AHReset(cache, kAHLayoutSizeCacheInitialCapacity)) {
+		AHLayoutSizeCacheClose(cache);
+		return NULL;
+	}
+	return cache;
+}
+
+void AHLayoutSizeCacheClose(AHLayoutSizeCache *cache) {
+	if (!cache) return;
+	AHUnmap(cache);
+	if (cache->fd >= 0) close(cache->fd);
+	free(cache);
+}
+
+void AHLayoutSizeCacheFlush(AHLayoutSizeCache *cache) {
+	if (cache->header) msync(cache->header, cache->length, MS_ASYNC);
+}
+
+#pragma mark - Table
+
+uint64_t AHLayoutSizeCacheKey(const void *bytes, size_t length) {
+	const unsigned char *b = bytes;
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= b[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static uint64_t AHSlotHash(uint64_t key, float crossExtent) {
+	uint32_t bits;
+	memcpy(&bits, &crossExtent, sizeof(bits));
+	// splitmix64 finalizer over the key and the extent
+	uint64_t x = key ^ ((uint64_t)bits * 0x9E3779B97F4A7C15ULL);
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+// The entry holding the key, or the empty one where it would go. NULL once
+// every slot has been probed, which only a damaged file with no free slot
+// left can lead to.
+static AHLayoutSizeCacheEntry *AHFind(const AHLayoutSizeCache *cache, uint64_t key, float crossExtent) {
+	uint64_t capacity = cache->header->capacity;
+	uint64_t mask = capacity - 1;
+	uint64_t slot = AHSlotHash(key, crossExtent) & mask;
+	for (uint64_t probes = 0; probes < capacity; probes++, slot = (slot + 1) & mask) {
+		AHLayoutSizeCacheEntry *entry = &cache->entries[slot];
+		if (!entry->used || (entry->key == key && entry->crossExtent == crossExtent)) return entry;
+	}
+	return NULL;
+}
+
+static bool AHGrow(AHLayoutSizeCache *cache) {
+	uint64_t capacity = cache->header->capacity;
+	size_t size = capacity * sizeof(AHLayoutSizeCacheEntry);
+	AHLayoutSizeCacheEntry *old = malloc(size);
+	if (!old) return false;
+	memcpy(old, cache->entries, size);
+	if (!AHReset(cache, capacity * 2)) {
+		free(old);
+		return false;
+	}
+	for (uint64_t i = 0; i < capacity; i++) {
+		if (!old[i].used) continue;
+		// The new table is twice as large, so there is always a free slot
+		*AHFind(cache, old[i].key, old[i].crossExtent) = old[i];
+		cache->header->count++;
+	}
+	free(old);
+	return true;
+}
+
+bool AHLayoutSizeCacheGet(const AHLayoutSizeCache *cache, uint64_t key, double crossExtent, double *width, double *height) {
+	if (!cache->header) return false;
+	AHLayoutSizeCacheEntry *entry = AHFind(cache, key, (float)crossExtent);
+	if (!entry || !entry->used) return false;
+	*width = entry->width;
+	*height = entry->height;
+	return true;
+}
+
+bool AHLayoutSizeCacheSet(AHLayoutSizeCache *cache, uint64_t key, double crossExtent, double width, double height) {
+	if (!cache->header) return false;
+	AHLayoutSizeCacheEntry *entry = AHFind(cache, key, (float)crossExtent);
+	if (!entry || !entry->used) {
+		// A full table doesn't add up, start afresh like any damaged file
+		if (!entry || cache->header->count >= cache->maximumCount) {
+			AHLayoutSizeCacheRemoveAll(cache);
+		} else if ((cache->header->count + 1) * 4 > cache->header->capacity * 3) {
+			// Keep the load under three quarters so probes stay short
+			if (!AHGrow(cache)) return false;
+		}
+		if (!cache->header) return false;
+		entry = AHFind(cache, key, (float)crossExtent);
+		if (!entry) return false;
+		entry->key = key;
+		entry->crossExtent = (float)crossExtent;
+		entry->used = 1;
+		cache->header->count++;
+	}
+	entry->width = (float)width;
+	entry->height = (float)height;
+	return true;
+}
+
+size_t AHLayoutSizeCacheCount(const AHLayoutSizeCache *cache) {
+	return cache->header ? cache->header->count : 0;
+}
+
+void AHLayoutSizeCacheRemoveAll(AHLayoutSizeCache *cache) {
+	AHReset(cache, kAHLayoutSizeCacheInitialCapacity);
+}
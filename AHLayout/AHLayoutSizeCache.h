@@ -0,0 +1,55 @@
+//
+//  AHLayoutSizeCache.h
+//  AHLayout
+//
+//  Copyright (c) 2013 Airheart. All rights reserved.
+//
+
+// Item sizes kept on disk from one launch to the next.
+//
+// Sizes are keyed by a stable item key, usually AHLayoutSizeCacheKey of an
+// identifier the data source hands out, together with the cross-axis extent
+// they were measured for, so a window of another width keeps its own sizes.
+//
+// The cache is an open addressed hash table with linear probing, laid out
+// directly in a memory-mapped file: a small header and then fixed size
+// entries. Opening maps the file and nothing is read up front, lookups and
+// stores are O(1) and the kernel writes the dirty pages back. A file from
+// another version, or one that doesn't add up, is started afresh.
+//
+// The table doubles as it fills, and is emptied once it holds the maximum
+// count, which keeps stale items from growing the file without bound.
+
+#ifndef AHLayoutSizeCache_h
+#define AHLayoutSizeCache_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AHLayoutSizeCache AHLayoutSizeCache;
+
+// Opens or creates the cache file at path, NULL if it can't be mapped.
+extern AHLayoutSizeCache *AHLayoutSizeCacheOpen(const char *path, size_t maximumCount);
+extern void AHLayoutSizeCacheClose(AHLayoutSizeCache *cache);
+
+// 64-bit FNV-1a hash of an identifier's bytes.
+extern uint64_t AHLayoutSizeCacheKey(const void *bytes, size_t length);
+
+extern bool AHLayoutSizeCacheGet(const AHLayoutSizeCache *cache, uint64_t key, double crossExtent, double *width, double *height);
+extern bool AHLayoutSizeCacheSet(AHLayoutSizeCache *cache, uint64_t key, double crossExtent, double width, double height);
+extern size_t AHLayoutSizeCacheCount(const AHLayoutSizeCache *cache);
+extern void AHLayoutSizeCacheRemoveAll(AHLayoutSizeCache *cache);
+
+// Schedules the dirty pages to be written without waiting for them.
+extern void AHLayoutSizeCacheFlush(AHLayoutSizeCache *cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
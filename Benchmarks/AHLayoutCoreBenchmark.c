@@ -0,0 +1,277 @@
+//
+//  AHLayoutCoreBenchmark.c
+//  AHLayout
+//
+//  Copyright (c) 2013 Airheart. All rights reserved.
+//
+
+// Times what AHLayout asks of its geometry core as lists grow: reloadData,
+// the first layout, scrolling a page at a time, single and batched edits,
+// runs of items added and removed at either end, scrollToViewAtIndex and
+// hit-testing, vertically and horizontally. Each operation replays the core
+// calls AHLayout and AHLayoutTransaction make for it, views aside. Results
+// are printed as JSON so runs can be compared between versions:
+//
+//   cc -O2 -std=c99 -Wall -Wno-unknown-pragmas -IAHLayout Benchmarks/AHLayoutCoreBenchmark.c AHLayout/AHLayoutCore.c AHLayout/AHLayout*Index.c -o core-bench -lm
+//   ./core-bench [number of items ...] > results.json
+//
+// Without arguments it runs 10k, 100k and 1M items.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "AHLayoutCore.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// A 800x600 view, as in the example app
+#define kBoundsWidth 800
+#define kBoundsHeight 600
+#define kEdits 1000
+#define kBatchSize 100
+// Older items loaded in front at a time, as a chat history does
+#define kRunLength 500
+#define kLookups 10000
+// The full sweep for small lists, evenly spread pages for large ones
+#define kMaxPages 100000
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double randomExtent(void) {
+	return 20 + rand() % 200;
+}
+
+static size_t randomPosition(size_t count) {
+	return (size_t)(((double)rand() / ((double)RAND_MAX + 1)) * count);
+}
+
+static volatile double sink;
+static int firstResult = 1;
+
+static void report(size_t items, const char *orientation, const char *operation, size_t iterations, double seconds) {
+	printf("%s\n    {\"items\": %zu, \"orientation\": \"%s\", \"operation\": \"%s\", \"iterations\": %zu, \"total_ms\": %.3f, \"ns_per_op\": %.1f}",
+		   firstResult ? "" : ",", items, orientation, operation, iterations, seconds * 1e3, seconds / iterations * 1e9);
+	firstResult = 0;
+}
+
+static AHLayoutItemFrame visibleRect(AHLayoutCore *core, AHLayoutPoint offset) {
+	return AHLayoutVisibleRectForContentOffset(offset, AHLayoutCoreGetBoundsSize(core));
+}
+
+// What a layout pass asks for once the visible rect is known: the items in
+// it and their frames. Returns how many there were.
+static size_t layoutVisibleItems(AHLayoutCore *core, AHLayoutItemFrame visible) {
+	size_t first, count;
+	AHLayoutCoreItemsInRect(core, visible, &first, &count);
+	for (size_t i = first; i < first + count; i++) {
+		sink += AHLayoutCoreFrameOfItem(core, i).y;
+	}
+	return count;
+}
+
+// The top of vertical content, the left of horizontal content
+static AHLayoutPoint startOffset(AHLayoutCore *core) {
+	AHLayoutPoint offset = {0, 0};
+	offset.y = -1e300;
+	return AHLayoutFixContentOffset(offset, AHLayoutCoreContentSize(core), AHLayoutCoreGetBoundsSize(core));
+}
+
+static void afterEdit(AHLayoutCore *core, AHLayoutPoint offset) {
+	AHLayoutSize contentSize = AHLayoutCoreContentSize(core);
+	offset = AHLayoutFixContentOffset(offset, contentSize, AHLayoutCoreGetBoundsSize(core));
+	layoutVisibleItems(core, visibleRect(core, offset));
+}
+
+static int run(size_t items, AHLayoutCoreType type, const char *orientation) {
+	int horizontal = type == AHLayoutCoreHorizontal;
+	double *widths = malloc(items * sizeof(double));
+	double *heights = malloc(items * sizeof(double));
+	for (size_t i = 0; i < items; i++) {
+		widths[i] = horizontal ? randomExtent() : kBoundsWidth;
+		heights[i] = horizontal ? kBoundsHeight : randomExtent();
+	}
+	AHLayoutCore *core = AHLayoutCoreCreate();
+	AHLayoutCoreSetType(core, type);
+	AHLayoutSize bounds = {kBoundsWidth, kBoundsHeight};
+	AHLayoutCoreSetBoundsSize(core, bounds);
+	AHLayoutOffsetIndex *index = AHLayoutCoreItems(core);
+	AHLayoutOffsetIndexSetSpacing(index, 10);
+
+	// reloadData, sizes already measured
+	double t = now();
+	AHLayoutOffsetIndexReset(index, items, widths, heights);
+	AHLayoutCoreItemsChanged(core, 0);
+	sink += AHLayoutCoreContentSize(core).height;
+	report(items, orientation, "reloadData", 1, now() - t);
+
+	t = now();
+	AHLayoutPoint offset = startOffset(core);
+	size_t shown = layoutVisibleItems(core, visibleRect(core, offset));
+	report(items, orientation, "firstLayout", 1, now() - t);
+	if (shown == 0) {
+		fprintf(stderr, "nothing visible after the first layout of %zu %s items\n", items, orientation);
+		return 1;
+	}
+
+	// Page by page from the start of the content to its end
+	AHLayoutSize contentSize = AHLayoutCoreContentSize(core);
+	double page = horizontal ? kBoundsWidth : kBoundsHeight;
+	double range = (horizontal ? contentSize.width : contentSize.height) - page;
+	size_t pages = (size_t)(range / page) + 1;
+	size_t step = pages > kMaxPages ? (pages + kMaxPages - 1) / kMaxPages : 1;
+	size_t swept = 0;
+	t = now();
+	for (size_t p = 0; p < pages; p += step, swept++) {
+		if (horizontal) {
+			offset.x = -(p * page);
+		} else {
+			offset.y = (p * page) - range;
+		}
+		offset = AHLayoutFixContentOffset(offset, contentSize, bounds);
+		if (layoutVisibleItems(core, visibleRect(core, offset)) == 0) {
+			fprintf(stderr, "empty page %zu of %zu %s items\n", p, items, orientation);
+			return 1;
+		}
+	}
+	report(items, orientation, "scrollByPage", swept, now() - t);
+	offset = startOffset(core);
+
+	// Single edits, each followed by the layout pass of its transaction
+	srand(11);
+	t = now();
+	for (size_t e = 0; e < kEdits; e++) {
+		size_t position = randomPosition(AHLayoutCoreCount(core) + 1);
+		AHLayoutOffsetIndexInsert(index, position, horizontal ? randomExtent() : kBoundsWidth, horizontal ? kBoundsHeight : randomExtent());
+		AHLayoutCoreItemsChanged(core, position);
+		afterEdit(core, offset);
+	}
+	report(items, orientation, "insert", kEdits, now() - t);
+
+	t = now();
+	for (size_t e = 0; e < kEdits; e++) {
+		size_t position = randomPosition(AHLayoutCoreCount(core));
+		AHLayoutOffsetIndexRemove(index, position);
+		AHLayoutCoreItemsChanged(core, position);
+		afterEdit(core, offset);
+	}
+	report(items, orientation, "remove", kEdits, now() - t);
+
+	t = now();
+	for (size_t e = 0; e < kEdits; e++) {
+		size_t position = randomPosition(AHLayoutCoreCount(core));
+		AHLayoutOffsetIndexSetSize(index, position, horizontal ? randomExtent() : kBoundsWidth, horizontal ? kBoundsHeight : randomExtent());
+		AHLayoutCoreItemResized(core, position);
+		afterEdit(core, offset);
+	}
+	report(items, orientation, "resize", kEdits, now() - t);
+
+	// Batches of edits share one layout pass, times are per batch
+	size_t batches = kEdits / kBatchSize;
+	t = now();
+	for (size_t b = 0; b < batches; b++) {
+		for (size_t e = 0; e < kBatchSize; e++) {
+			size_t position = randomPosition(AHLayoutCoreCount(core) + 1);
+			AHLayoutOffsetIndexInsert(index, position, horizontal ? randomExtent() : kBoundsWidth, horizontal ? kBoundsHeight : randomExtent());
+			AHLayoutCoreItemsChanged(core, position);
+		}
+		afterEdit(core, offset);
+	}
+	report(items, orientation, "batchInsert100", batches, now() - t);
+
+	t = now();
+	for (size_t b = 0; b < batches; b++) {
+		for (size_t e = 0; e < kBatchSize; e++) {
+			size_t position = randomPosition(AHLayoutCoreCount(core));
+			AHLayoutOffsetIndexRemove(index, position);
+			AHLayoutCoreItemsChanged(core, position);
+		}
+		afterEdit(core, offset);
+	}
+	report(items, orientation, "batchRemove100", batches, now() - t);
+
+	t = now();
+	for (size_t b = 0; b < batches; b++) {
+		for (size_t e = 0; e < kBatchSize; e++) {
+			size_t position = randomPosition(AHLayoutCoreCount(core));
+			AHLayoutOffsetIndexSetSize(index, position, horizontal ? randomExtent() : kBoundsWidth, horizontal ? kBoundsHeight : randomExtent());
+			AHLayoutCoreItemResized(core, position);
+		}
+		afterEdit(core, offset);
+	}
+	report(items, orientation, "batchResize100", batches, now() - t);
+
+	// Runs loaded in front and let go of at the far end, each one splice
+	double *runWidths = malloc(kRunLength * sizeof(double));
+	double *runHeights = malloc(kRunLength * sizeof(double));
+	for (size_t i = 0; i < kRunLength; i++) {
+		runWidths[i] = horizontal ? randomExtent() : kBoundsWidth;
+		runHeights[i] = horizontal ? kBoundsHeight : randomExtent();
+	}
+	t = now();
+	for (size_t b = 0; b < batches; b++) {
+		AHLayoutOffsetIndexInsertRange(index, 0, kRunLength, runWidths, runHeights, 0);
+		AHLayoutCoreItemsChanged(core, 0);
+		afterEdit(core, offset);
+	}
+	report(items, orientation, "prependRun500", batches, now() - t);
+
+	t = now();
+	for (size_t b = 0; b < batches; b++) {
+		size_t position = AHLayoutCoreCount(core) - kRunLength;
+		AHLayoutOffsetIndexRemoveRange(index, position, kRunLength);
+		AHLayoutCoreItemsChanged(core, position);
+		afterEdit(core, offset);
+	}
+	report(items, orientation, "removeRun500", batches, now() - t);
+	free(runWidths);
+	free(runHeights);
+
+	// scrollToViewAtIndex: the smallest scroll showing the item, then a layout pass
+	contentSize = AHLayoutCoreContentSize(core);
+	t = now();
+	for (size_t e = 0; e < kLookups; e++) {
+		AHLayoutItemFrame frame = AHLayoutCoreFrameOfItem(core, randomPosition(AHLayoutCoreCount(core)));
+		offset = AHLayoutContentOffsetShowingRect(offset, frame, visibleRect(core, offset), horizontal);
+		offset = AHLayoutFixContentOffset(offset, contentSize, bounds);
+		layoutVisibleItems(core, visibleRect(core, offset));
+	}
+	report(items, orientation, "scrollToViewAtIndex", kLookups, now() - t);
+
+	// Hit-testing at random points in the content
+	size_t hits = 0;
+	t = now();
+	for (size_t e = 0; e < kLookups; e++) {
+		AHLayoutPoint point = {((double)rand() / RAND_MAX) * contentSize.width, ((double)rand() / RAND_MAX) * contentSize.height};
+		if (AHLayoutCoreItemAtPoint(core, point) != AHLayoutNotFound) hits++;
+	}
+	report(items, orientation, "hitTest", kLookups, now() - t);
+	if (hits == 0) {
+		fprintf(stderr, "no hits among %zu %s items\n", items, orientation);
+		return 1;
+	}
+
+	AHLayoutCoreFree(core);
+	free(widths);
+	free(heights);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	size_t defaults[] = {10000, 100000, 1000000};
+	size_t runs = argc > 1 ? (size_t)argc - 1 : sizeof(defaults) / sizeof(defaults[0]);
+	srand(7);
+
+	printf("{\n  \"benchmark\": \"AHLayoutCore\",\n  \"bounds\": [%d, %d],\n  \"results\": [", kBoundsWidth, kBoundsHeight);
+	for (size_t r = 0; r < runs; r++) {
+		size_t items = argc > 1 ? strtoul(argv[r + 1], NULL, 10) : defaults[r];
+		if (items == 0) continue;
+		if (run(items, AHLayoutCoreVertical, "vertical") || run(items, AHLayoutCoreHorizontal, "horizontal")) return 1;
+	}
+	printf("\n  ]\n}\n");
+	return 0;
+}
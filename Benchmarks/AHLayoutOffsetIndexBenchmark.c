@@ -0,0 +1,195 @@
+//
+//  AHLayoutOffsetIndexBenchmark.c
+//  AHLayout
+//
+//  Copyright (c) 2013 Airheart. All rights reserved.
+//
+
+// Compares AHLayoutOffsetIndex with the linear offset pass that
+// AHLayoutTransaction used to run after every insert, remove or resize.
+// It has no AppKit dependency, build and run it anywhere with:
+//
+//   cc -O2 -std=c99 -Wall -Wno-unknown-pragmas -IAHLayout Benchmarks/AHLayoutOffsetIndexBenchmark.c AHLayout/AHLayoutOffsetIndex.c -o offset-bench -lm
+//   ./offset-bench [number of items] [number of edits]
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "AHLayoutOffsetIndex.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The old calculateContentSize + calculateObjectOffsetsVertical
+typedef struct {
+	size_t count;
+	double *heights;
+	double *y;
+	double spacing;
+	double contentHeight;
+} LinearLayout;
+
+static void linearCalculate(LinearLayout *l) {
+	double height = 0;
+	for (size_t i = 0; i < l->count; i++) height += l->heights[i] + l->spacing;
+	l->contentHeight = height;
+	double offset = height;
+	for (size_t i = 0; i < l->count; i++) {
+		offset -= l->heights[i] + l->spacing;
+		l->y[i] = offset + l->spacing;
+	}
+}
+
+static void linearInsert(LinearLayout *l, size_t position, double height) {
+	memmove(&l->heights[position + 1], &l->heights[position], (l->count - position) * sizeof(double));
+	l->heights[position] = height;
+	l->count++;
+	linearCalculate(l);
+}
+
+static void linearRemove(LinearLayout *l, size_t position) {
+	memmove(&l->heights[position], &l->heights[position + 1], (l->count - position - 1) * sizeof(double));
+	l->count--;
+	linearCalculate(l);
+}
+
+static double randomHeight(void) {
+	return 20 + rand() % 200;
+}
+
+// The old objectIndexesInRect: scan
+static size_t linearItemsInExtent(LinearLayout *l, double start, double end, size_t *first) {
+	size_t count = 0;
+	for (size_t i = 0; i < l->count; i++) {
+		if (l->y[i] < end && l->y[i] + l->heights[i] > start) {
+			if (count == 0) *first = i;
+			count++;
+		}
+	}
+	return count;
+}
+
+static int verify(LinearLayout *l, AHLayoutOffsetIndex *index) {
+	if (AHLayoutOffsetIndexCount(index) != l->count) return 0;
+	if (fabs(AHLayoutOffsetIndexContentExtent(index) - l->contentHeight) > 1e-6) return 0;
+	AHLayoutItemGeometry *g = malloc(l->count * sizeof(AHLayoutItemGeometry));
+	AHLayoutOffsetIndexCopyGeometry(index, 0, l->count, g);
+	int ok = 1;
+	for (size_t i = 0; i < l->count && ok; i++) {
+		ok = fabs(g[i].offset - l->y[i]) < 1e-6 && g[i].height == l->heights[i];
+	}
+	free(g);
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+	size_t edits = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000;
+	srand(7);
+
+	LinearLayout linear = {count, malloc((count + edits) * sizeof(double)), malloc((count + edits) * sizeof(double)), 10, 0};
+	double *widths = malloc(count * sizeof(double));
+	for (size_t i = 0; i < count; i++) {
+		linear.heights[i] = randomHeight();
+		widths[i] = 320;
+	}
+	AHLayoutOffsetIndex *index = AHLayoutOffsetIndexCreate(AHLayoutOffsetIndexAxisVertical, 10);
+
+	double t = now();
+	linearCalculate(&linear);
+	double linearBuild = now() - t;
+	t = now();
+	AHLayoutOffsetIndexReset(index, count, widths, linear.heights);
+	double indexBuild = now() - t;
+
+	if (!verify(&linear, index)) {
+		fprintf(stderr, "offsets differ after build\n");
+		return 1;
+	}
+
+	// Every edit is followed by a lookup of the item's new offset, which
+	// is what a layout pass needs for the views on screen.
+	double linearResize = 0, indexResize = 0;
+	double linearInsertTime = 0, indexInsertTime = 0;
+	double linearRemoveTime = 0, indexRemoveTime = 0;
+	volatile double sink = 0;
+	for (size_t e = 0; e < edits; e++) {
+		size_t position = rand() % linear.count;
+		double height = randomHeight();
+
+		t = now();
+		linear.heights[position] = height;
+		linearCalculate(&linear);
+		sink += linear.y[position];
+		linearResize += now() - t;
+		t = now();
+		AHLayoutOffsetIndexSetSize(index, position, 320, height);
+		sink += AHLayoutOffsetIndexOffsetOfItem(index, position);
+		indexResize += now() - t;
+
+		position = rand() % (linear.count + 1);
+		t = now();
+		linearInsert(&linear, position, height);
+		sink += linear.y[position];
+		linearInsertTime += now() - t;
+		t = now();
+		AHLayoutOffsetIndexInsert(index, position, 320, height);
+		sink += AHLayoutOffsetIndexOffsetOfItem(index, position);
+		indexInsertTime += now() - t;
+
+		position = rand() % linear.count;
+		t = now();
+		linearRemove(&linear, position);
+		sink += linear.contentHeight;
+		linearRemoveTime += now() - t;
+		t = now();
+		AHLayoutOffsetIndexRemove(index, position);
+		sink += AHLayoutOffsetIndexContentExtent(index);
+		indexRemoveTime += now() - t;
+	}
+
+	if (!verify(&linear, index)) {
+		fprintf(stderr, "offsets differ after edits\n");
+		return 1;
+	}
+
+	// Visible range lookups for a 800pt viewport scrolled to random offsets
+	double linearRange = 0, indexRange = 0;
+	for (size_t e = 0; e < edits; e++) {
+		double start = fmod(rand() * 7.0, linear.contentHeight + 400) - 200;
+		double end = start + 800;
+		size_t linearFirst = 0, indexFirst = 0, indexCount = 0;
+		t = now();
+		size_t linearCount = linearItemsInExtent(&linear, start, end, &linearFirst);
+		linearRange += now() - t;
+		t = now();
+		AHLayoutOffsetIndexItemsInExtent(index, start, end, &indexFirst, &indexCount);
+		indexRange += now() - t;
+		if (linearCount != indexCount || (linearCount && linearFirst != indexFirst)) {
+			fprintf(stderr, "visible range differs for (%f, %f)\n", start, end);
+			return 1;
+		}
+	}
+
+	printf("%zu items, %zu edits of each kind (times per operation)\n", count, edits);
+	printf("%-10s %14s %14s %10s\n", "", "linear (us)", "index (us)", "speedup");
+	printf("%-10s %14.2f %14.2f %9.1fx\n", "build", linearBuild * 1e6, indexBuild * 1e6, linearBuild / indexBuild);
+	printf("%-10s %14.2f %14.2f %9.1fx\n", "resize", linearResize / edits * 1e6, indexResize / edits * 1e6, linearResize / indexResize);
+	printf("%-10s %14.2f %14.2f %9.1fx\n", "insert", linearInsertTime / edits * 1e6, indexInsertTime / edits * 1e6, linearInsertTime / indexInsertTime);
+	printf("%-10s %14.2f %14.2f %9.1fx\n", "remove", linearRemoveTime / edits * 1e6, indexRemoveTime / edits * 1e6, linearRemoveTime / indexRemoveTime);
+	printf("%-10s %14.2f %14.2f %9.1fx\n", "in rect", linearRange / edits * 1e6, indexRange / edits * 1e6, linearRange / indexRange);
+
+	AHLayoutOffsetIndexFree(index);
+	free(linear.heights);
+	free(linear.y);
+	free(widths);
+	return 0;
+}
@@ -0,0 +1,129 @@
+//
+//  AHLayoutParallelSizingBenchmark.c
+//  AHLayout
+//
+//  Copyright (c) 2013 Airheart. All rights reserved.
+//
+
+// Measures how reloadData scales when the data source implements
+// layout:sizesOfViewsInRange:. AHLayout hands out batches of
+// kAHLayoutSizingBatchSize items to dispatch_apply, each batch writes its
+// slice of the width and height arrays, and the offset index is then built
+// from them on the main thread. This does the same with pthreads and a
+// stand-in for text measurement so it runs headless on Linux:
+//
+//   cc -O2 -std=c99 -Wall -Wno-unknown-pragmas -pthread -IAHLayout Benchmarks/AHLayoutParallelSizingBenchmark.c AHLayout/AHLayoutOffsetIndex.c -o sizing-bench -lm
+//   ./sizing-bench [number of items] [max threads]
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "AHLayoutOffsetIndex.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define kBatchSize 256
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Roughly the cost of laying out a few lines of attributed text,
+// the height depends on the item so every run builds the same index.
+static double measureItem(size_t item) {
+	double width = 320;
+	unsigned int seed = (unsigned int)item * 2654435761u;
+	int characters = 40 + (seed >> 24);
+	double lineWidth = 0;
+	int lines = 1;
+	for (int c = 0; c < characters; c++) {
+		seed = seed * 1103515245u + 12345u;
+		double advance = 5 + sqrt((double)(seed >> 16 & 0xff)) + sin(c) * 0.5;
+		lineWidth += advance;
+		if (lineWidth > width) {
+			lines++;
+			lineWidth = advance;
+		}
+	}
+	return lines * 18.0 + 8;
+}
+
+typedef struct {
+	size_t count;
+	size_t batches;
+	size_t nextBatch;
+	pthread_mutex_t lock;
+	double *widths;
+	double *heights;
+} SizingJob;
+
+static void *sizingWorker(void *context) {
+	SizingJob *job = context;
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		size_t batch = job->nextBatch++;
+		pthread_mutex_unlock(&job->lock);
+		if (batch >= job->batches) return NULL;
+		size_t start = batch * kBatchSize;
+		size_t end = start + kBatchSize < job->count ? start + kBatchSize : job->count;
+		for (size_t i = start; i < end; i++) {
+			job->widths[i] = 320;
+			job->heights[i] = measureItem(i);
+		}
+	}
+}
+
+// Sizes every item on `threads` threads and builds the index, returns seconds
+static double reload(AHLayoutOffsetIndex *index, size_t count, size_t threads, double *widths, double *heights) {
+	SizingJob job = {count, (count + kBatchSize - 1) / kBatchSize, 0, PTHREAD_MUTEX_INITIALIZER, widths, heights};
+	pthread_t *workers = malloc(threads * sizeof(pthread_t));
+	double t = now();
+	for (size_t i = 1; i < threads; i++) pthread_create(&workers[i], NULL, sizingWorker, &job);
+	// The calling thread takes batches too, as dispatch_apply does
+	sizingWorker(&job);
+	for (size_t i = 1; i < threads; i++) pthread_join(workers[i], NULL);
+	AHLayoutOffsetIndexReset(index, count, widths, heights);
+	t = now() - t;
+	free(workers);
+	return t;
+}
+
+int main(int argc, char **argv) {
+	size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t maxThreads = argc > 2 ? strtoul(argv[2], NULL, 10) : (size_t)(cores > 0 ? cores : 1);
+	if (maxThreads == 0) maxThreads = 1;
+
+	double *widths = malloc(count * sizeof(double));
+	double *heights = malloc(count * sizeof(double));
+	AHLayoutOffsetIndex *index = AHLayoutOffsetIndexCreate(AHLayoutOffsetIndexAxisVertical, 10);
+
+	printf("%zu items, %ld cores\n", count, cores);
+	printf("%-10s %12s %10s\n", "threads", "reload ms", "speedup");
+	double serial = 0;
+	double serialExtent = 0;
+	for (size_t threads = 1;; threads = threads * 2 < maxThreads ? threads * 2 : maxThreads) {
+		double t = reload(index, count, threads, widths, heights);
+		double extent = AHLayoutOffsetIndexContentExtent(index);
+		if (threads == 1) {
+			serial = t;
+			serialExtent = extent;
+		} else if (extent != serialExtent) {
+			fprintf(stderr, "content extent differs with %zu threads\n", threads);
+			return 1;
+		}
+		printf("%-10zu %12.2f %9.1fx\n", threads, t * 1000, serial / t);
+		if (threads == maxThreads) break;
+	}
+
+	AHLayoutOffsetIndexFree(index);
+	free(widths);
+	free(heights);
+	return 0;
+}
@@ -0,0 +1,480 @@
+//
+//  AHLayoutTests.c
+//  AHLayout
+//
+//  Copyright (c) 2013 Airheart. All rights reserved.
+//
+
+// Checks the plain C half of AHLayout against naive models of the same
+// thing: the offset, flow, masonry and section indexes, the frames and items
+// in a rect the core hands out, rebasing positions through edits with runs
+// and moves, the diff and a size cache closed and opened again. Most checks
+// replay random edits with a fixed seed, so a failure repeats run to run.
+//
+//   make -C Tests test
+//
+// Every failed check is printed with its line, the exit status is non-zero
+// if any failed.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "AHLayoutCore.h"
+#include "AHLayoutDiff.h"
+#include "AHLayoutSectionIndex.h"
+#include "AHLayoutSizeCache.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int failures;
+
+#define AHCheck(condition) do { \
+	if (!(condition)) { \
+		fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #condition); \
+		failures++; \
+		return; \
+	} \
+} while (0)
+
+static bool AHClose(double a, double b) {
+	return fabs(a - b) < 1e-6;
+}
+
+static double AHRandom(int low, int high) {
+	return low + rand() % (high - low + 1);
+}
+
+static bool AHFramesCross(AHLayoutItemFrame frame, double start, double end) {
+	return frame.y < end && frame.y + frame.height > start;
+}
+
+#pragma mark - Offset index
+
+static void AHTestOffsetIndex(void) {
+	enum { kMaximumCount = 20000 };
+	static double heights[kMaximumCount];
+	double spacing = 2;
+	size_t count = 0;
+	AHLayoutOffsetIndex *index = AHLayoutOffsetIndexCreate(AHLayoutOffsetIndexAxisVertical, spacing);
+
+	for (int step = 0; step < 2000; step++) {
+		size_t position = count ? rand() % (count + 1) : 0;
+		size_t length = rand() % 100;
+		int operation = rand() % 4;
+		if (operation < 2) {
+			if (count + length > kMaximumCount) continue;
+			double widths[100], added[100];
+			for (size_t i = 0; i < length; i++) {
+				widths[i] = 1;
+				added[i] = AHRandom(0, 50);
+			}
+			AHCheck(AHLayoutOffsetIndexInsertRange(index, position, length, widths, added, 0));
+			memmove(heights + position + length, heights + position, (count - position) * sizeof(double));
+			memcpy(heights + position, added, length * sizeof(double));
+			count += length;
+		} else if (operation == 2) {
+			if (position >= count) continue;
+			if (length > count - position) length = count - position;
+			AHLayoutOffsetIndexRemoveRange(index, position, length);
+			memmove(heights + position, heights + position + length, (count - position - length) * sizeof(double));
+			count -= length;
+		} else {
+			if (count == kMaximumCount) continue;
+			double height = AHRandom(0, 50);
+			AHCheck(AHLayoutOffsetIndexInsert(index, position, 1, height));
+			memmove(heights + position + 1, heights + position, (count - position) * sizeof(double));
+			heights[position] = height;
+			count++;
+		}
+		AHCheck(AHLayoutOffsetIndexCount(index) == count);
+	}
+
+	// Item 0 is at the top, every item followed by the spacing
+	double extent = 0;
+	for (size_t i = 0; i < count; i++) extent += heights[i] + spacing;
+	AHCheck(AHClose(AHLayoutOffsetIndexContentExtent(index), extent));
+	double top = extent;
+	for (size_t i = 0; i < count; i++) {
+		top -= heights[i];
+		AHLayoutItemGeometry geometry = AHLayoutOffsetIndexGeometryOfItem(index, i);
+		AHCheck(AHClose(geometry.offset, top));
+		AHCheck(geometry.height == heights[i]);
+		top -= spacing;
+	}
+
+	for (int query = 0; query < 200; query++) {
+		double start = AHRandom(0, (int)extent), end = start + AHRandom(1, 400);
+		size_t first, found;
+		AHLayoutOffsetIndexItemsInExtent(index, start, end, &first, &found);
+		for (size_t i = 0; i < found; i++) {
+			AHLayoutItemGeometry geometry = AHLayoutOffsetIndexGeometryOfItem(index, first + i);
+			AHCheck(geometry.offset <= end && geometry.offset + geometry.height >= start);
+		}
+	}
+	AHLayoutOffsetIndexFree(index);
+}
+
+#pragma mark - Core
+
+static void AHTestCoreFrames(void) {
+	AHLayoutCore *core = AHLayoutCoreCreate();
+	AHLayoutOffsetIndex *items = AHLayoutCoreItems(core);
+	AHCheck(AHLayoutOffsetIndexResetUniform(items, 100, 100, 10));
+	AHLayoutCoreItemsChanged(core, 0);
+	AHLayoutCoreSetBoundsSize(core, (AHLayoutSize){100, 200});
+
+	AHLayoutSize contentSize = AHLayoutCoreContentSize(core);
+	AHCheck(contentSize.width == 100 && contentSize.height == 1000);
+	AHLayoutItemFrame frame = AHLayoutCoreFrameOfItem(core, 0);
+	AHCheck(frame.y == 990 && frame.height == 10 && frame.width == 100);
+	AHCheck(AHLayoutCoreFrameOfItem(core, 99).y == 0);
+
+	size_t first, count;
+	AHCheck(AHLayoutCoreItemsInRect(core, (AHLayoutItemFrame){0, 20, 100, 30}, &first, &count));
+	AHCheck(first == 95 && count == 3);
+	AHCheck(AHLayoutCoreItemAtPoint(core, (AHLayoutPoint){5, 55}) == 94);
+
+	AHLayoutCoreSetType(core, AHLayoutCoreHorizontal);
+	AHCheck(AHLayoutCoreFrameOfItem(core, 3).x == 300);
+	AHCheck(AHLayoutCoreItemsInRect(core, (AHLayoutItemFrame){250, 0, 200, 10}, &first, &count));
+	AHCheck(first == 2 && count == 3);
+
+	// One 100 point item a line
+	AHLayoutCoreSetType(core, AHLayoutCoreFlow);
+	AHCheck(AHLayoutCoreContentSize(core).height == 1000);
+	AHLayoutCoreFree(core);
+}
+
+static void AHTestFlow(void) {
+	AHLayoutCore *core = AHLayoutCoreCreate();
+	AHLayoutOffsetIndex *items = AHLayoutCoreItems(core);
+	AHLayoutOffsetIndexSetSpacing(items, 4);
+	AHLayoutCoreSetType(core, AHLayoutCoreFlow);
+	AHLayoutCoreSetBoundsSize(core, (AHLayoutSize){400, 300});
+	for (size_t i = 0; i < 500; i++) {
+		AHCheck(AHLayoutOffsetIndexInsert(items, i, AHRandom(10, 100), AHRandom(10, 100)));
+	}
+	AHLayoutCoreItemsChanged(core, 0);
+
+	for (int step = 0; step < 100; step++) {
+		size_t position = rand() % AHLayoutCoreCount(core);
+		AHLayoutOffsetIndexSetSize(items, position, AHRandom(10, 100), AHRandom(10, 100));
+		AHLayoutCoreItemResized(core, position);
+
+		AHLayoutFlowIndex *flow = AHLayoutCorePackedFlow(core);
+		size_t count = AHLayoutCoreCount(core);
+		for (size_t i = 1; i < count; i++) {
+			AHLayoutItemFrame previous = AHLayoutCoreFrameOfItem(core, i - 1), frame = AHLayoutCoreFrameOfItem(core, i);
+			AHCheck(frame.x + frame.width <= 400);
+			if (AHLayoutFlowIndexLineOfItem(flow, i) == AHLayoutFlowIndexLineOfItem(flow, i - 1)) {
+				AHCheck(frame.x >= previous.x + previous.width);
+			} else {
+				AHCheck(frame.y + frame.height <= previous.y);
+			}
+		}
+
+		double extent = AHLayoutCoreContentSize(core).height, start = AHRandom(0, (int)extent), end = start + 300;
+		size_t first, found;
+		AHLayoutCoreItemsInRect(core, (AHLayoutItemFrame){0, start, 400, 300}, &first, &found);
+		for (size_t i = 0; i < count; i++) {
+			if (AHFramesCross(AHLayoutCoreFrameOfItem(core, i), start, end)) AHCheck(i >= first && i - first < found);
+		}
+	}
+	AHLayoutCoreFree(core);
+}
+
+static void AHTestMasonry(void) {
+	AHLayoutCore *core = AHLayoutCoreCreate();
+	AHLayoutOffsetIndex *items = AHLayoutCoreItems(core);
+	AHLayoutOffsetIndexSetSpacing(items, 6);
+	AHLayoutCoreSetType(core, AHLayoutCoreMasonry);
+	AHLayoutCoreSetColumnCount(core, 3);
+	AHLayoutCoreSetBoundsSize(core, (AHLayoutSize){500, 300});
+	for (size_t i = 0; i < 600; i++) {
+		AHCheck(AHLayoutOffsetIndexInsert(items, i, 100, AHRandom(20, 220)));
+	}
+	AHLayoutCoreItemsChanged(core, 0);
+
+	for (int step = 0; step < 100; step++) {
+		size_t position = rand() % AHLayoutCoreCount(core);
+		if (step % 2) {
+			AHLayoutOffsetIndexSetSize(items, position, 100, AHRandom(20, 220));
+			AHLayoutCoreItemResized(core, position);
+		} else {
+			AHLayoutOffsetIndexRemove(items, position);
+			AHCheck(AHLayoutOffsetIndexInsert(items, rand() % (AHLayoutCoreCount(core) + 1), 100, AHRandom(20, 220)));
+			AHLayoutCoreItemsChanged(core, position);
+		}
+
+		// Items in a column stack without overlapping, columns share the width
+		AHLayoutMasonryIndex *masonry = AHLayoutCorePackedMasonry(core);
+		size_t count = AHLayoutCoreCount(core);
+		double bottoms[3] = {INFINITY, INFINITY, INFINITY};
+		double columnWidth = (500 - 4 * 6) / 3.0;
+		for (size_t i = 0; i < count; i++) {
+			size_t column = AHLayoutMasonryIndexColumnOfItem(masonry, i);
+			AHLayoutItemFrame frame = AHLayoutCoreFrameOfItem(core, i);
+			AHCheck(column < 3);
+			AHCheck(AHClose(frame.width, columnWidth) && AHClose(frame.x, 6 + column * (columnWidth + 6)));
+			AHCheck(frame.y + frame.height <= bottoms[column]);
+			bottoms[column] = frame.y;
+		}
+
+		double extent = AHLayoutCoreContentSize(core).height, start = AHRandom(0, (int)extent), end = start + 300;
+		size_t first, found;
+		AHLayoutCoreItemsInRect(core, (AHLayoutItemFrame){0, start, 500, 300}, &first, &found);
+		size_t crossing = 0;
+		for (size_t i = 0; i < count; i++) {
+			if (!AHFramesCross(AHLayoutCoreFrameOfItem(core, i), start, end)) continue;
+			AHCheck(i >= first && i - first < found);
+			crossing++;
+		}
+
+		// Only the items on the rect are listed, whatever the run holds
+		size_t positions[64];
+		found = AHLayoutCoreCopyItemsInRect(core, (AHLayoutItemFrame){0, start, 500, 300}, positions, 64);
+		AHCheck(found == crossing && found <= 64);
+		for (size_t i = 0; i < found; i++) {
+			AHCheck(AHFramesCross(AHLayoutCoreFrameOfItem(core, positions[i]), start, end));
+		}
+	}
+
+	// One tall item keeps its column from taking any of the short ones after it
+	AHLayoutOffsetIndexResetUniform(items, 1000, 100, 10);
+	AHLayoutOffsetIndexSetSize(items, 0, 100, 5000);
+	AHLayoutCoreItemsChanged(core, 0);
+	double extent = AHLayoutCoreContentSize(core).height;
+	size_t first, found, positions[16];
+	AHLayoutCoreItemsInRect(core, (AHLayoutItemFrame){0, extent - 2000, 500, 100}, &first, &found);
+	AHCheck(first == 0 && found > 100);
+	found = AHLayoutCoreCopyItemsInRect(core, (AHLayoutItemFrame){0, extent - 2000, 500, 100}, positions, 16);
+	AHCheck(found > 1 && found < 16 && positions[0] == 0);
+	AHLayoutCoreFree(core);
+}
+
+#pragma mark - Sections
+
+static void AHTestSections(void) {
+	AHLayoutSectionIndex *sections = AHLayoutSectionIndexCreate();
+	size_t itemCounts[] = {3, 0, 2, 5};
+	AHCheck(AHLayoutSectionIndexReset(sections, 4, itemCounts));
+	AHCheck(AHLayoutSectionIndexItemCount(sections) == 10);
+	AHCheck(AHLayoutSectionIndexSectionOfItem(sections, 2) == 0);
+	AHCheck(AHLayoutSectionIndexSectionOfItem(sections, 3) == 2);
+	AHCheck(AHLayoutSectionIndexSectionOfItem(sections, 5) == 3);
+	AHCheck(AHLayoutSectionIndexFirstItem(sections, 3) == 5);
+
+	AHLayoutSectionIndexInsertItem(sections, 3);
+	AHCheck(AHLayoutSectionIndexItemCountInSection(sections, 2) == 3);
+	AHLayoutSectionIndexInsertItem(sections, 11);
+	AHCheck(AHLayoutSectionIndexItemCountInSection(sections, 3) == 6);
+	AHLayoutSectionIndexRemoveItem(sections, 0);
+	AHCheck(AHLayoutSectionIndexFirstItem(sections, 2) == 2);
+
+	// The headers of sections 1 and 2 both lead item 2
+	AHLayoutSectionIndexSetHeaderExtent(sections, 1, 20);
+	AHLayoutSectionIndexSetHeaderExtent(sections, 2, 30);
+	AHCheck(AHLayoutSectionIndexLeadOfItem(sections, 2, 5) == 60);
+	AHCheck(AHLayoutSectionIndexLeadOfItem(sections, 3, 5) == 0);
+	AHCheck(AHLayoutSectionIndexHeaderOffsetInLead(sections, 2, 5) == 25);
+	AHLayoutSectionIndexFree(sections);
+}
+
+#pragma mark - Edits
+
+// Applies random edit lists, runs and moves included, to a list of item
+// numbers and checks every original item ends up where rebasing says.
+static void AHTestEdits(void) {
+	enum { kCount = 64, kEdits = 12 };
+	for (int round = 0; round < 2000; round++) {
+		size_t list[kCount * 4], count = kCount;
+		AHLayoutEdit edits[kEdits];
+		size_t editCount = 0;
+		for (size_t i = 0; i < count; i++) list[i] = i;
+
+		while (editCount < kEdits) {
+			AHLayoutEdit edit = {AHLayoutEditUpdate, 0, 0, 1};
+			int operation = rand() % 4;
+			if (operation == 0 && count > 0) {
+				// A move, its removal right before its insertion
+				if (editCount + 2 > kEdits) break;
+				edit.kind = AHLayoutEditRemove;
+				edit.position = rand() % count;
+				size_t item = list[edit.position];
+				memmove(list + edit.position, list + edit.position + 1, (count - edit.position - 1) * sizeof(size_t));
+				count--;
+				edits[editCount++] = edit;
+				edit.kind = AHLayoutEditInsert;
+				edit.moveSource = editCount;
+				edit.position = rand() % (count + 1);
+				memmove(list + edit.position + 1, list + edit.position, (count - edit.position) * sizeof(size_t));
+				list[edit.position] = item;
+				count++;
+			} else if (operation == 1 && count > 0) {
+				edit.kind = AHLayoutEditRemove;
+				edit.position = rand() % count;
+				edit.length = 1 + rand() % (count - edit.position < 5 ? count - edit.position : 5);
+				memmove(list + edit.position, list + edit.position + edit.length, (count - edit.position - edit.length) * sizeof(size_t));
+				count -= edit.length;
+			} else {
+				edit.kind = AHLayoutEditInsert;
+				edit.position = rand() % (count + 1);
+				edit.length = 1 + rand() % 5;
+				memmove(list + edit.position + edit.length, list + edit.position, (count - edit.position) * sizeof(size_t));
+				for (size_t i = 0; i < edit.length; i++) list[edit.position + i] = AHLayoutNotFound;
+				count += edit.length;
+			}
+			edits[editCount++] = edit;
+		}
+
+		size_t expected[kCount];
+		for (size_t i = 0; i < kCount; i++) expected[i] = AHLayoutNotFound;
+		for (size_t i = 0; i < count; i++) {
+			if (list[i] != AHLayoutNotFound) expected[list[i]] = i;
+		}
+		for (size_t i = 0; i < kCount; i++) {
+			AHCheck(AHLayoutEditsPositionAfter(edits, editCount, i) == expected[i]);
+		}
+		// And the same for some of them at once
+		size_t positions[kCount], original[kCount], positionCount = 0;
+		for (size_t i = 0; i < kCount; i++) {
+			if (rand() % 2) continue;
+			original[positionCount] = positions[positionCount] = i;
+			positionCount++;
+		}
+		AHLayoutEditsRebasePositions(edits, editCount, positions, positionCount);
+		for (size_t i = 0; i < positionCount; i++) AHCheck(positions[i] == expected[original[i]]);
+	}
+
+	// An update names its item as of the edits before it
+	AHLayoutEdit edits[] = {
+		{AHLayoutEditRemove, 3, 0, 1},
+		{AHLayoutEditInsert, 7, 1, 1},
+		{AHLayoutEditInsert, 0, 0, 2},
+	};
+	AHCheck(AHLayoutEditsPositionAfter(edits, 3, 3) == 9);
+	AHCheck(AHLayoutEditsPositionAfter(edits, 3, 5) == 6);
+	AHCheck(AHLayoutEditsPositionAfterEdit(edits, 3, 2, 7) == 9);
+}
+
+#pragma mark - Diff
+
+static void AHTestDiff(void) {
+	enum { kMaximumCount = 300 };
+	size_t oldItems[kMaximumCount], newItems[kMaximumCount];
+	size_t oldToNew[kMaximumCount], newToOld[kMaximumCount];
+	bool moved[kMaximumCount];
+
+	for (int round = 0; round < 500; round++) {
+		size_t oldCount = rand() % kMaximumCount, newCount = rand() % kMaximumCount, symbolCount = 50 + rand() % 400;
+		for (size_t i = 0; i < oldCount; i++) oldItems[i] = rand() % symbolCount;
+		for (size_t i = 0; i < newCount; i++) newItems[i] = rand() % symbolCount;
+		AHCheck(AHLayoutDiff(oldItems, oldCount, newItems, newCount, symbolCount, oldToNew, newToOld, moved));
+
+		for (size_t i = 0; i < oldCount; i++) {
+			if (oldToNew[i] != AHLayoutNotFound) AHCheck(newItems[oldToNew[i]] == oldItems[i] && newToOld[oldToNew[i]] == i);
+		}
+
+		// The items that stay keep their order and are as many as can be
+		size_t stayed = 0, last = 0, paired = 0, longest = 0;
+		size_t runs[kMaximumCount];
+		for (size_t j = 0; j < newCount; j++) {
+			if (newToOld[j] == AHLayoutNotFound) continue;
+			if (!moved[j]) {
+				AHCheck(stayed == 0 || newToOld[j] > last);
+				last = newToOld[j];
+				stayed++;
+			}
+			runs[paired] = 1;
+			for (size_t k = 0, l = 0; k < j; k++) {
+				if (newToOld[k] == AHLayoutNotFound) continue;
+				if (newToOld[k] < newToOld[j] && runs[l] + 1 > runs[paired]) runs[paired] = runs[l] + 1;
+				l++;
+			}
+			if (runs[paired] > longest) longest = runs[paired];
+			paired++;
+		}
+		AHCheck(stayed == longest);
+	}
+
+	size_t rotated[] = {4, 0, 1, 2, 3};
+	size_t identity[] = {0, 1, 2, 3, 4};
+	AHCheck(AHLayoutDiff(identity, 5, rotated, 5, 5, oldToNew, newToOld, moved));
+	AHCheck(moved[0] && !moved[1] && !moved[4]);
+}
+
+#pragma mark - Size cache
+
+static void AHTestSizeCache(void) {
+	char path[] = "/tmp/AHLayoutTests.XXXXXX";
+	int file = mkstemp(path);
+	AHCheck(file >= 0);
+	close(file);
+
+	AHLayoutSizeCache *cache = AHLayoutSizeCacheOpen(path, 100000);
+	AHCheck(cache);
+	char identifier[32];
+	for (int i = 0; i < 20000; i++) {
+		snprintf(identifier, sizeof(identifier), "item-%d", i);
+		AHCheck(AHLayoutSizeCacheSet(cache, AHLayoutSizeCacheKey(identifier, strlen(identifier)), 320, 320, i % 300));
+	}
+	AHCheck(AHLayoutSizeCacheCount(cache) == 20000);
+	AHLayoutSizeCacheClose(cache);
+
+	cache = AHLayoutSizeCacheOpen(path, 100000);
+	AHCheck(cache);
+	AHCheck(AHLayoutSizeCacheCount(cache) == 20000);
+	double width, height;
+	for (int i = 0; i < 20000; i++) {
+		snprintf(identifier, sizeof(identifier), "item-%d", i);
+		AHCheck(AHLayoutSizeCacheGet(cache, AHLayoutSizeCacheKey(identifier, strlen(identifier)), 320, &width, &height));
+		AHCheck(width == 320 && height == i % 300);
+	}
+	// Sizes for another width are kept apart
+	AHCheck(!AHLayoutSizeCacheGet(cache, AHLayoutSizeCacheKey("item-1", 6), 400, &width, &height));
+	AHLayoutSizeCacheRemoveAll(cache);
+	AHCheck(AHLayoutSizeCacheCount(cache) == 0);
+	AHLayoutSizeCacheClose(cache);
+
+	// A damaged file with every slot taken misses rather than probing forever
+	// (entries are 24 bytes after a 32 byte header, the used flag last)
+	FILE *damaged = fopen(path, "r+b");
+	AHCheck(damaged);
+	for (long slot = 0; slot < 1024; slot++) {
+		uint64_t key = 0x9E3779B97F4A7C15ULL * (slot + 1);
+		uint32_t used = 1;
+		fseek(damaged, 32 + slot * 24, SEEK_SET);
+		fwrite(&key, sizeof(key), 1, damaged);
+		fseek(damaged, 32 + slot * 24 + 20, SEEK_SET);
+		fwrite(&used, sizeof(used), 1, damaged);
+	}
+	fclose(damaged);
+	cache = AHLayoutSizeCacheOpen(path, 100000);
+	AHCheck(cache);
+	AHCheck(!AHLayoutSizeCacheGet(cache, AHLayoutSizeCacheKey("item-1", 6), 320, &width, &height));
+	AHCheck(AHLayoutSizeCacheSet(cache, AHLayoutSizeCacheKey("item-1", 6), 320, 320, 44));
+	AHCheck(AHLayoutSizeCacheGet(cache, AHLayoutSizeCacheKey("item-1", 6), 320, &width, &height) && height == 44);
+	AHLayoutSizeCacheClose(cache);
+	unlink(path);
+}
+
+int main(void) {
+	srand(5);
+	AHTestOffsetIndex();
+	AHTestCoreFrames();
+	AHTestFlow();
+	AHTestMasonry();
+	AHTestSections();
+	AHTestEdits();
+	AHTestDiff();
+	AHTestSizeCache();
+	if (failures) {
+		fprintf(stderr, "%d failed\n", failures);
+		return 1;
+	}
+	printf("All passed\n");
+	return 0;
+}